@@ -206,6 +206,9 @@ namespace octet {
     // information for our text
     bitmap_font font;
 
+    // the score text, redrawn only when the score or lives change
+    ui_layer score_layer;
+
     ALuint get_sound_source() { return sources[cur_source++ % num_sound_sources]; }
 
     // called when we hit an enemy
@@ -374,37 +377,48 @@ namespace octet {
     }
 
 
-    void draw_text(texture_shader &shader, float x, float y, float scale, const char *text) {
-      mat4t modelToWorld;
-      modelToWorld.loadIdentity();
-      modelToWorld.translate(x, y, 0);
-      modelToWorld.scale(scale, scale, 1);
-      mat4t modelToProjection = mat4t::build_projection_matrix(modelToWorld, cameraToWorld);
+    // the text is drawn into layer when it changes; otherwise the cached layer is drawn
+    void draw_text(ui_layer &layer, texture_shader &shader, float x, float y, float scale, const char *text) {
+      // the text is laid out in font pixels from -256 to 256 around (x, y)
+      enum { half_size = 256 };
 
-      /*mat4t tmp;
-      glLoadIdentity();
-      glTranslatef(x, y, 0);
-      glGetFloatv(GL_MODELVIEW_MATRIX, (float*)&tmp);
-      glScalef(scale, scale, 1);
-      glGetFloatv(GL_MODELVIEW_MATRIX, (float*)&tmp);*/
+      if (layer.begin_update(half_size * 2, half_size * 2, ui_layer::get_key(text))) {
+        enum { max_quads = 32 };
+        bitmap_font::vertex vertices[max_quads*4];
+        uint32_t indices[max_quads*6];
+        aabb bb(vec3(0, 0, 0), vec3(half_size, half_size, 0));
 
-      enum { max_quads = 32 };
-      bitmap_font::vertex vertices[max_quads*4];
-      uint32_t indices[max_quads*6];
-      aabb bb(vec3(0, 0, 0), vec3(256, 256, 0));
+        unsigned num_quads = font.build_mesh(bb, vertices, indices, max_quads, text, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, font_texture);
 
-      unsigned num_quads = font.build_mesh(bb, vertices, indices, max_quads, text, 0);
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, font_texture);
+        mat4t fontToLayer;
+        fontToLayer.loadIdentity();
+        fontToLayer.translate(half_size, half_size, 0);
+        shader.render(fontToLayer * layer.get_pixel_to_projection(), 0);
 
-      shader.render(modelToProjection, 0);
+        glVertexAttribPointer(attribute_pos, 3, GL_FLOAT, GL_FALSE, sizeof(bitmap_font::vertex), (void*)&vertices[0].x );
+        glEnableVertexAttribArray(attribute_pos);
+        glVertexAttribPointer(attribute_uv, 3, GL_FLOAT, GL_FALSE, sizeof(bitmap_font::vertex), (void*)&vertices[0].u );
+        glEnableVertexAttribArray(attribute_uv);
 
-      glVertexAttribPointer(attribute_pos, 3, GL_FLOAT, GL_FALSE, sizeof(bitmap_font::vertex), (void*)&vertices[0].x );
-      glEnableVertexAttribArray(attribute_pos);
-      glVertexAttribPointer(attribute_uv, 3, GL_FLOAT, GL_FALSE, sizeof(bitmap_font::vertex), (void*)&vertices[0].u );
-      glEnableVertexAttribArray(attribute_uv);
+        glDrawElements(GL_TRIANGLES, num_quads * 6, GL_UNSIGNED_INT, indices);
 
-      glDrawElements(GL_TRIANGLES, num_quads * 6, GL_UNSIGNED_INT, indices);
+        glDisableVertexAttribArray(attribute_pos);
+        glDisableVertexAttribArray(attribute_uv);
+        layer.end_update();
+      }
+
+      mat4t modelToWorld;
+      modelToWorld.loadIdentity();
+      modelToWorld.translate(x - half_size * scale, y - half_size * scale, 0);
+      modelToWorld.scale(half_size * 2 * scale, half_size * 2 * scale, 1);
+      mat4t modelToProjection = mat4t::build_projection_matrix(modelToWorld, cameraToWorld);
+
+      layer.composite(shader, modelToProjection);
+
+      // the sprites expect the usual blending
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     }
 
   public:
@@ -529,7 +543,7 @@ namespace octet {
 
       char score_text[32];
       sprintf(score_text, "score: %d   lives: %d\n", score, num_lives);
-      draw_text(texture_shader_, -1.75f, 2, 1.0f/256, score_text);
+      draw_text(score_layer, texture_shader_, -1.75f, 2, 1.0f/256, score_text);
 
       // move the listener with the camera
       vec4 &cpos = cameraToWorld.w();
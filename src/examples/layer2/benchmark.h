@@ -0,0 +1,278 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Ciro Duran, Bogdan Catana 2013, 2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Diffraction shader benchmark. Sweeps the shader parameters and writes timings to CSV.
+//
+
+namespace octet {
+  /*
+   * benchmark - renders the CD and the cube with each diffraction shader over a grid of
+   * roughness, spacing, CD tessellation and resolution, and writes one CSV line per
+   * combination:
+   *
+   *   model,shader,rough,spacing,ring_vertices,rings,resolution,vertices,triangles,frame_ms,min_frame_ms,gl_calls
+   *
+   * Each combination is drawn into a resolution x resolution square of the window with
+   * glFinish() after every frame, so frame_ms is the time the GPU took, not the swap rate.
+   * Resolutions bigger than the window are skipped.
+   *
+   * frame_ms is the time for all the timed frames divided by their number, so it does not
+   * depend on the clock resolution. min_frame_ms is the fastest single frame.
+   *
+   * gl_calls is the number of GL calls in one frame: the ones made here, plus the ones the
+   * shaders, meshes and buffers count as they make them (shader::get_stats,
+   * mesh::get_stats and gl_resource::get_stats), eg. buffer uploads on bind.
+   */
+  class benchmark : public app {
+    enum shader_kind {
+      SHADER_VERTEX,
+      SHADER_FRAGMENT,
+      SHADER_LUT,
+      NUM_SHADERS
+    };
+
+    // the CD at each tessellation, then the cube
+    struct geometry {
+      const char *model;
+      unsigned short ring_vertices;
+      unsigned short rings;
+    };
+
+    enum {
+      num_geometries = 6,
+      num_roughs = 3,
+      num_spacings = 3,
+      num_resolutions = 4,
+      warmup_frames = 5,
+      timed_frames = 20
+    };
+
+    static const geometry &get_geometry(unsigned i) {
+      static const geometry geometries[num_geometries] = {
+        { "cd", 15, 5 },
+        { "cd", 30, 10 },
+        { "cd", 60, 20 },
+        { "cd", 120, 40 },
+        { "cd", 240, 80 },
+        { "cube", 0, 0 },
+      };
+      return geometries[i];
+    }
+
+    static float get_rough(unsigned i) {
+      static const float roughs[num_roughs] = { 10.0f, 50.0f, 200.0f };
+      return roughs[i];
+    }
+
+    static float get_spacing(unsigned i) {
+      static const float spacings[num_spacings] = { 5.0f, 10.0f, 50.0f };
+      return spacings[i];
+    }
+
+    static int get_resolution(unsigned i) {
+      static const int resolutions[num_resolutions] = { 128, 256, 512, 1024 };
+      return resolutions[i];
+    }
+
+    static const char *get_shader_name(unsigned i) {
+      switch (i) {
+        case SHADER_VERTEX: return "vertex";
+        case SHADER_FRAGMENT: return "fragment";
+        default: return "lut";
+      }
+    }
+
+    const char *csv_path;
+    FILE *csv;
+
+    // the next combination to run, counting with the resolution fastest
+    unsigned next_test;
+    unsigned num_tests;
+
+    // the geometry currently in model
+    int current_geometry;
+    mesh model;
+
+    GLuint cubeMapTex;
+    cubemap_diffraction_shader vertexShader;
+    cubemap_fragdiffraction_shader fragmentShader;
+    cubemap_lutdiffraction_shader lutShader;
+
+    // gl calls made by draw_test itself
+    unsigned gl_calls;
+
+    void build_geometry(unsigned i) {
+      if ((int)i == current_geometry) return;
+      current_geometry = (int)i;
+
+      mesh_builder mb;
+      const geometry &g = get_geometry(i);
+      if (g.ring_vertices) {
+        mb.add_one_CD(0.3f, 2.0f, 1.0f, 1.0f, g.ring_vertices, g.rings);
+      } else {
+        mb.init(24, 36);
+        engine::addDiffractionCube(mb);
+      }
+      mb.get_mesh(model);
+    }
+
+    // draw one frame of a combination and wait for the GPU to finish
+    void draw_test(unsigned shader_index, float rough, float spacing, int resolution, float angle) {
+      glViewport(0, 0, resolution, resolution);
+      glScissor(0, 0, resolution, resolution);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      gl_calls += 3;
+
+      mat4t cameraToWorld;
+      cameraToWorld.loadIdentity();
+      cameraToWorld.translate(0.0f, 0.0f, 3.0f);
+
+      mat4t modelToWorld;
+      modelToWorld.loadIdentity();
+      modelToWorld.rotate(angle, 0.0f, 1.0f, 0.0f);
+
+      mat4t modelToProjection = mat4t::build_projection_matrix(modelToWorld, cameraToWorld);
+      mat3 modelToWorldIT = mat3::inverse3x3(modelToWorld);
+
+      vec3 cameraPos = (vec4(0.0f, 0.0f, 0.0f, 1.0f)*cameraToWorld).xyz();
+      vec3 lightPosition = vec3(0.0f, -1.0f*sin(10*3.14159f/180.0f), 1.0f*cos(10*3.14159f/180.0f));
+      vec4 hiliteColor = vec4(1.0f, 0.7f, 0.3f, 1.0f);
+
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMapTex);
+      gl_calls += 2;
+
+      switch (shader_index) {
+        case SHADER_VERTEX: {
+          vertexShader.render(modelToProjection, modelToWorld, modelToWorldIT, rough, spacing, hiliteColor, lightPosition, cameraPos, 0);
+        } break;
+        case SHADER_FRAGMENT: {
+          fragmentShader.render(modelToProjection, modelToWorld, modelToWorldIT, rough, spacing, hiliteColor, lightPosition, cameraPos, 0);
+        } break;
+        default: {
+          lutShader.render(modelToProjection, modelToWorld, modelToWorldIT, spacing, hiliteColor, lightPosition, cameraPos, 0, 1);
+        } break;
+      }
+
+      model.render();
+
+      glFinish();
+      gl_calls += 1;
+    }
+
+    // run every frame of one combination and write its CSV line
+    void run_test(unsigned test) {
+      unsigned i = test;
+      unsigned res_index = i % num_resolutions; i /= num_resolutions;
+      unsigned spacing_index = i % num_spacings; i /= num_spacings;
+      unsigned rough_index = i % num_roughs; i /= num_roughs;
+      unsigned shader_index = i % NUM_SHADERS; i /= NUM_SHADERS;
+      unsigned geometry_index = i;
+
+      int vx, vy;
+      get_viewport_size(vx, vy);
+      int resolution = get_resolution(res_index);
+      if (resolution > vx || resolution > vy) return;
+
+      build_geometry(geometry_index);
+      float rough = get_rough(rough_index);
+      float spacing = get_spacing(spacing_index);
+      if (shader_index == SHADER_LUT) {
+        // rebuilding the lookup texture is not part of a frame
+        lutShader.update_lut(rough);
+      }
+
+      for (unsigned f = 0; f != warmup_frames; ++f) {
+        draw_test(shader_index, rough, spacing, resolution, f * 7.0f);
+      }
+
+      double min_time = 1e9;
+      shader::reset_stats();
+      mesh::reset_stats();
+      gl_resource::reset_stats();
+      gl_calls = 0;
+      double block_start = get_time();
+      for (unsigned f = 0; f != timed_frames; ++f) {
+        double start = get_time();
+        draw_test(shader_index, rough, spacing, resolution, f * 7.0f);
+        double time = get_time() - start;
+        if (time < min_time) min_time = time;
+      }
+      double total = get_time() - block_start;
+
+      shader::stats shader_stats = shader::get_stats();
+      mesh::stats mesh_stats = mesh::get_stats();
+      gl_resource::stats buffer_stats = gl_resource::get_stats();
+      unsigned calls = gl_calls +
+        shader_stats.program_binds + shader_stats.uniform_sets + shader_stats.texture_calls +
+        mesh_stats.attribute_calls + mesh_stats.draws +
+        buffer_stats.buffer_binds + buffer_stats.buffer_uploads
+      ;
+      unsigned calls_per_frame = calls / timed_frames;
+
+      const geometry &g = get_geometry(geometry_index);
+      fprintf(
+        csv, "%s,%s,%.1f,%.1f,%d,%d,%d,%d,%d,%.4f,%.4f,%d\n",
+        g.model, get_shader_name(shader_index), rough, spacing, g.ring_vertices, g.rings, resolution,
+        model.get_num_vertices(), model.get_num_indices() / 3,
+        total * 1000.0 / timed_frames, min_time * 1000.0, calls_per_frame
+      );
+    }
+
+  public:
+    benchmark(int argc, char **argv, const char *csv_path) : app(argc, argv) {
+      this->csv_path = csv_path;
+      csv = 0;
+      next_test = 0;
+      num_tests = num_geometries * NUM_SHADERS * num_roughs * num_spacings * num_resolutions;
+      current_geometry = -1;
+      gl_calls = 0;
+      cubeMapTex = 0;
+
+      // each frame is timed with glFinish, so do not wait between them
+      get_frame_timer().set_mode(frame_timer::mode_unlimited);
+    }
+
+    void app_init() {
+      vertexShader.init();
+      fragmentShader.init();
+      lutShader.init();
+
+      cubeMapTex = resources::get_cubemap_texture_handle(GL_RGBA, "Tenerife4",
+        "assets/cubemaps/Tenerife4/posx.jpg", "assets/cubemaps/Tenerife4/posy.jpg", "assets/cubemaps/Tenerife4/posz.jpg",
+        "assets/cubemaps/Tenerife4/negx.jpg", "assets/cubemaps/Tenerife4/negy.jpg", "assets/cubemaps/Tenerife4/negz.jpg");
+
+      csv = fopen(csv_path, "w");
+      if (!csv) {
+        printf("benchmark: could not open %s\n", csv_path);
+        exit(1);
+      }
+      fprintf(csv, "model,shader,rough,spacing,ring_vertices,rings,resolution,vertices,triangles,frame_ms,min_frame_ms,gl_calls\n");
+    }
+
+    // one combination per frame, so that the window keeps updating
+    void draw_world(int x, int y, int w, int h) {
+      if (next_test == num_tests) {
+        fclose(csv);
+        printf("benchmark: wrote %s\n", csv_path);
+        exit(0);
+      }
+
+      glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+      glEnable(GL_DEPTH_TEST);
+      glEnable(GL_SCISSOR_TEST);
+      glEnable(GL_TEXTURE_CUBE_MAP);
+
+      run_test(next_test++);
+
+      glDisable(GL_SCISSOR_TEST);
+
+      if ((next_test % 50) == 0) {
+        printf("benchmark: %d/%d\n", next_test, num_tests);
+      }
+    }
+  };
+}
@@ -26,44 +26,78 @@ namespace octet {
     vec3 lightPosition;
     
     bool rotating;
-    bool just_press_rotating;
 
-    bool is_frag_shader_mode;
-    bool just_press_frag_shader_mode;
+    enum diffraction_mode {
+      DIFFRACTION_AUTO,
+      DIFFRACTION_VERTEX,
+      DIFFRACTION_FRAGMENT,
+      DIFFRACTION_SPECTRAL,
+      DIFFRACTION_LUT,
+      NUM_DIFFRACTION_MODES
+    };
+    diffraction_mode current_diffraction_mode;
+
+    // wavelength bins for the spectral shader, see get_diffraction_glsl
+    enum { num_spectral_bins = 16 };
+
+    // in automatic mode, the per-vertex shader is used when the triangles are
+    // smaller than this on screen; interpolating the colour is then not noticeable.
+    float max_vertex_triangle_pixels;
+    diffraction_mode auto_diffraction_mode;
 
-    bool just_press_dump_info;
+    // the diffraction shaders drop orders when frames take longer than this
+    double last_frame_time;
+
+    // shader gl calls made and skipped in the last frame
+    shader::stats last_shader_stats;
     
     bool normals_visible;
-    bool just_press_normals_visible;
 
     bool tangents_visible;
-    bool just_press_tangents_visible;
+
+    // the CD uses the coarsest level of detail whose edges are no longer than this on screen
+    float max_cd_edge_pixels;
+    unsigned cd_level;
 
     bool show_help;
-    bool just_press_show_help;
 
     enum model {
       MODEL_CD,
-      MODEL_CUBE
+      MODEL_CUBE,
+      MODEL_SHELF,
+      NUM_MODELS
     };
     model current_model;
-    bool just_press_change_model;
+
+    // the shelf is a grid of discs drawn as instances of ring
+    enum { shelf_columns = 10, shelf_rows = 10 };
+    float shelf_rough;
+    float shelf_spacing;
+    vec4 shelf_hiliteColor;
 
     // helper to rotate camera about scene
     //mouse_ball ball;
 
     GLuint cubeMapTex;
     GLuint helpTex;
+    ui_layer help_layer;
 
-    cubemap_fragdiffraction_shader cubeMapDiffractionShader;
-    cubemap_diffraction_shader cubeMapVertexDifractionShader;
+    diffraction_variants<cubemap_fragdiffraction_shader> cubeMapDiffractionShader;
+    diffraction_variants<cubemap_diffraction_shader> cubeMapVertexDifractionShader;
+    diffraction_variants<cubemap_fragdiffraction_shader> cubeMapSpectralDiffractionShader;
+    cubemap_lutdiffraction_shader cubeMapLutDiffractionShader;
+    cubemap_instanceddiffraction_shader cubeMapInstancedDiffractionShader;
     cubemap_sky_shader cubeMapSkyShader;
     texture_shader tShader;
     color_shader cshader;
 
     mesh ring;
+    lod_mesh cd;
     mesh ring_normals;
     mesh ring_tangents;
+    mesh sky_cube;
+    mesh diffraction_cube;
+    instanced_mesh shelf;
 
   public:
     // this is called when we construct the class
@@ -81,6 +115,9 @@ namespace octet {
       // set up the shaders
       cubeMapDiffractionShader.init();
       cubeMapVertexDifractionShader.init();
+      cubeMapSpectralDiffractionShader.init(7, num_spectral_bins);
+      cubeMapLutDiffractionShader.init();
+      cubeMapInstancedDiffractionShader.init();
       cubeMapSkyShader.init();
       cshader.init();
       tShader.init();
@@ -91,24 +128,23 @@ namespace octet {
       rough = 50.0f;
       spacing = 10.0f;
       rotating = true;
-      just_press_rotating = false;
 
-      is_frag_shader_mode = true;
-      just_press_frag_shader_mode = false;
+      current_diffraction_mode = DIFFRACTION_AUTO;
+      max_vertex_triangle_pixels = 4.0f;
+      auto_diffraction_mode = DIFFRACTION_FRAGMENT;
 
       current_model = MODEL_CD;
-      just_press_change_model = false;
 
-      just_press_dump_info = false;
+      last_frame_time = 0;
+      memset(&last_shader_stats, 0, sizeof(last_shader_stats));
 
       normals_visible = false;
-      just_press_normals_visible = false;
-
       tangents_visible = false;
-      just_press_tangents_visible = false;
+
+      max_cd_edge_pixels = 16.0f;
+      cd_level = 0;
 
       show_help = true;
-      just_press_show_help = false;
 
       lightPosition = vec3(0.0f, -1.0f*sin(10*3.14159f/180.0f), 1.0f*cos(10*3.14159f/180.0f));
       hiliteColor = vec4(1.0f, 0.7f, 0.3f, 1.0f);
@@ -117,11 +153,26 @@ namespace octet {
       mb.add_one_CD(0.3f, 2.0f, 1.0f, 1.0f);
       mb.get_mesh(ring);
 
+      // the CD model has four levels of detail, from 240x80 down to the 30x10 of ring
+      unsigned cd_first_index[5];
+      mb.init();
+      unsigned num_cd_levels = mb.add_CD_lods(0.3f, 2.0f, 1.0f, 1.0f, 240, 80, 4, cd_first_index);
+      cd.init(mb, cd_first_index, num_cd_levels);
+
       ring_normals.init();
-      ring_normals.make_normal_visualizer(ring, 1.0f, attribute_normal);
+      ring_normals.make_normal_visualizer(cd.get_mesh(), 1.0f, attribute_normal);
 
       ring_tangents.init();
-      ring_tangents.make_normal_visualizer(ring, 1.0f, attribute_tangent);
+      ring_tangents.make_normal_visualizer(cd.get_mesh(), 1.0f, attribute_tangent);
+
+      shelf.init(&ring);
+      shelf_rough = -1.0f;
+
+      mb.init();
+      mb.add_inside_out_cube(1.0f);
+      mb.get_mesh(sky_cube);
+
+      buildDiffractionCube();
 
       glBindBuffer(GL_ARRAY_BUFFER, 0);
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
@@ -139,6 +190,19 @@ namespace octet {
 
     // this is called to draw the world
     void draw_world(int x, int y, int w, int h) {
+      // time since the last call, so this includes the swap and any wait for vsync
+      double now = get_time();
+      if (last_frame_time != 0) {
+        float frame_time = (float)(now - last_frame_time);
+        cubeMapDiffractionShader.update(frame_time);
+        cubeMapVertexDifractionShader.update(frame_time);
+        cubeMapSpectralDiffractionShader.update(frame_time);
+      }
+      last_frame_time = now;
+
+      last_shader_stats = shader::get_stats();
+      shader::reset_stats();
+
       int vx, vy;
       get_viewport_size(vx, vy);
       // set a viewport - includes whole window area
@@ -152,133 +216,314 @@ namespace octet {
 
       if (current_model == MODEL_CD) {
         renderCD();
-      } else {
+      } else if (current_model == MODEL_CUBE) {
         renderCube();
+      } else {
+        renderShelf();
       }
 
       renderHelp();
-      
-      if (rotating) rotateAngle += 1.0f;
+    }
+
+    // moves the camera and changes the parameters while keys are held down,
+    // and toggles the settings on key presses. anything that changes the picture
+    // sets a dirty flag; when there is none the frame is not drawn.
+    bool update_world(float timestep) {
+      // the movement speeds are per 60th of a second
+      float steps = timestep * 60.0f;
 
+      if (rotating) {
+        rotateAngle += 1.0f * steps;
+        set_dirty(dirty_animation);
+      }
+
+      float pan = 0.25f * (camera_position[2]/5.0f) * steps;
       if (is_key_down('W')) {
-        camera_position[1] += 0.25f * (camera_position[2]/5.0f);
+        camera_position[1] += pan;
+        set_dirty(dirty_camera);
       } else if (is_key_down('S')) {
-        camera_position[1] -= 0.25f * (camera_position[2]/5.0f);
+        camera_position[1] -= pan;
+        set_dirty(dirty_camera);
       }
 
       if (is_key_down('A')) {
-        camera_position[0] -= 0.25f * (camera_position[2]/5.0f);
+        camera_position[0] -= pan;
+        set_dirty(dirty_camera);
       } else if (is_key_down('D')) {
-        camera_position[0] += 0.25f * (camera_position[2]/5.0f);
+        camera_position[0] += pan;
+        set_dirty(dirty_camera);
       }
 
       if (is_key_down('Q')) {
-        camera_position[2] -= 0.25f;
+        camera_position[2] -= 0.25f * steps;
         if (camera_position[2] < 2.0f) camera_position[2] = 2.0f;
+        set_dirty(dirty_camera);
       } else if (is_key_down('E')) {
-        camera_position[2] += 0.25f;
+        camera_position[2] += 0.25f * steps;
         if (camera_position[2] > 200.0f) camera_position[2] = 200.0f;
+        set_dirty(dirty_camera);
       }
 
-       if (is_key_down('F')) {
-        camera_rotation[1] += 5.0f;
+      if (is_key_down('F')) {
+        camera_rotation[1] += 5.0f * steps;
         if (camera_rotation[1] >= 360.0f) camera_rotation[1] -= 360.0f;
+        set_dirty(dirty_camera);
       } else if (is_key_down('H')) {
-        camera_rotation[1] -= 5.0f;
+        camera_rotation[1] -= 5.0f * steps;
         if (camera_rotation[1] < 0.0f) camera_rotation[1] += 360.0f;
+        set_dirty(dirty_camera);
       }
 
       if (is_key_down('G')) {
-        camera_rotation[0] -= 5.0f;
+        camera_rotation[0] -= 5.0f * steps;
         if (camera_rotation[0] < -60.0f) camera_rotation[0] = -60.0f;
+        set_dirty(dirty_camera);
       } else if (is_key_down('T')) {
-        camera_rotation[0] += 5.0f;
+        camera_rotation[0] += 5.0f * steps;
         if (camera_rotation[0] > 60.0f) camera_rotation[0] = 60.0f;
+        set_dirty(dirty_camera);
       }
 
       if (is_key_down('Z')) {
-        rough -= 1.0f;
+        rough -= 1.0f * steps;
         if (rough < 1.0f) rough = 1.0f;
+        set_dirty(dirty_parameters);
       } else if (is_key_down('X')) {
-        rough += 1.0f;
+        rough += 1.0f * steps;
         if (rough > 500.0f) rough = 500.0f;
+        set_dirty(dirty_parameters);
       }
 
       if (is_key_down('C')) {
-        spacing -= 1.0f;
+        spacing -= 1.0f * steps;
         if (spacing < 1.0f) spacing = 1.0f;
+        set_dirty(dirty_parameters);
       } else if (is_key_down('V')) {
-        spacing += 1.0f;
+        spacing += 1.0f * steps;
         if (spacing > 500.0f) spacing = 500.0f;
+        set_dirty(dirty_parameters);
       }
 
-      if (is_key_down(key_space) && !just_press_rotating) {
-        rotating = !rotating;
-        just_press_rotating = true;
-      }
-      if (!is_key_down(key_space)) {
-        just_press_rotating = false;
+      for (unsigned i = 0; i != get_num_input_events(); ++i) {
+        const input_event &event = get_input_event(i);
+        if (!event.is_down) continue;
+
+        switch (event.key) {
+          case key_space: {
+            rotating = !rotating;
+            set_dirty(dirty_animation);
+          } break;
+          case 'B': {
+            current_model = (model)((current_model + 1) % NUM_MODELS);
+            printf("Change model to %s.\n", get_model_name(current_model));
+            set_dirty(dirty_parameters);
+          } break;
+          case 'N': {
+            current_diffraction_mode = (diffraction_mode)((current_diffraction_mode + 1) % NUM_DIFFRACTION_MODES);
+            printf("Change shader to %s.\n", get_diffraction_mode_name(current_diffraction_mode));
+            set_dirty(dirty_parameters);
+          } break;
+          case 'M': {
+            dump_info();
+          } break;
+          case 'K': case 'L': {
+            int quality = cubeMapDiffractionShader.get_quality() + (event.key == 'L' ? 1 : -1);
+            cubeMapDiffractionShader.set_quality(quality);
+            cubeMapVertexDifractionShader.set_quality(quality);
+            cubeMapSpectralDiffractionShader.set_quality(quality);
+            printf("Diffraction quality: %d orders.\n", cubeMapDiffractionShader.get_quality());
+            set_dirty(dirty_parameters);
+          } break;
+          case 'I': {
+            shelf.set_use_instancing(!shelf.get_use_instancing());
+            printf("Shelf drawn %s.\n", shelf.get_use_instancing() ? "instanced" : "merged on the CPU");
+            set_dirty(dirty_parameters);
+          } break;
+          case 'R': {
+            normals_visible = !normals_visible;
+            printf("Normals visible: %s.\n", normals_visible? "yes": "no");
+            set_dirty(dirty_parameters);
+          } break;
+          case 'Y': {
+            tangents_visible = !tangents_visible;
+            printf("Tangents visible: %s.\n", tangents_visible? "yes": "no");
+            set_dirty(dirty_parameters);
+          } break;
+          case 'J': {
+            show_help = !show_help;
+            set_dirty(dirty_parameters);
+          } break;
+        }
       }
 
-      if (is_key_down('B') && !just_press_change_model) {
-        printf("Change model to %s.\n", current_model == MODEL_CD? "cube": "cd");
-        current_model = current_model == MODEL_CD? MODEL_CUBE: MODEL_CD;
-        just_press_change_model = true;
-      }
-      if (!is_key_down('B')) {
-        just_press_change_model = false;
+      if (!get_dirty()) {
+        // the gap until the next drawn frame is not a slow frame
+        last_frame_time = 0;
       }
 
-      if (is_key_down('N') && !just_press_change_model) {
-        printf("Change shader to %s.\n", is_frag_shader_mode? "vertex-based": "fragment-based");
-        is_frag_shader_mode = !is_frag_shader_mode;
-        just_press_frag_shader_mode = true;
+      // only draw when something above made the view dirty
+      return false;
+    }
+
+    // print the settings and the statistics of the last frames
+    void dump_info() {
+      printf("Current shader is %s.\n", get_diffraction_mode_name(current_diffraction_mode));
+      if (current_diffraction_mode == DIFFRACTION_AUTO) {
+        printf("Automatic shader is %s.\n", get_diffraction_mode_name(auto_diffraction_mode));
       }
-      if (!is_key_down('N')) {
-        just_press_frag_shader_mode = false;
+      printf("Current model is %s.\n", get_model_name(current_model));
+      if (current_model == MODEL_CD) {
+        printf("CD level of detail: %d of %d, %d triangles.\n", cd_level, cd.get_num_levels(), cd.get_num_indices(cd_level) / 3);
       }
-
-      if (is_key_down('M') && !just_press_dump_info) {
-        printf("Current shader is %s.\n", is_frag_shader_mode? "fragment-based": "vertex-based");
-        printf("Current model is %s.\n", current_model == MODEL_CD? "CD": "cube");
-        printf("Rough: %.2f.\n", rough);
-        printf("Spacing: %.2f.\n", spacing);
-        printf("Light position: (%.2f, %2.f, %.2f)\n", lightPosition[0], lightPosition[1], lightPosition[2]);
-        printf("Hilite color: (%.2f, %.2f, %.2f, %.2f)\n", hiliteColor[0], hiliteColor[1], hiliteColor[2], hiliteColor[3]);
-        printf("Camera position: (%.2f, %.2f, %.2f), Rotation: (%.2f, %.2f, %.2f)\n\n", camera_position[0], camera_position[1], camera_position[2], camera_rotation[0], camera_rotation[1], camera_rotation[2]);
-        just_press_dump_info = true;
+      if (current_model == MODEL_SHELF) {
+        printf("Shelf: %d discs, %s.\n", shelf.get_num_instances(), shelf.get_use_instancing() ? "instanced" : "merged on the CPU");
       }
-      if (!is_key_down('N')) {
-        just_press_dump_info = false;
+      printf("Diffraction orders: %d (quality %d).\n", cubeMapDiffractionShader.get_num_orders(), cubeMapDiffractionShader.get_quality());
+      unsigned uniform_total = last_shader_stats.uniform_sets + last_shader_stats.uniform_sets_skipped;
+      printf(
+        "Last frame: %d/%d program binds, %d/%d uniform sets skipped (%.0f%% redundant).\n",
+        last_shader_stats.program_binds_skipped, last_shader_stats.program_binds + last_shader_stats.program_binds_skipped,
+        last_shader_stats.uniform_sets_skipped, uniform_total,
+        uniform_total ? last_shader_stats.uniform_sets_skipped * 100.0f / uniform_total : 0.0f
+      );
+      printf("Rough: %.2f.\n", rough);
+      printf("Spacing: %.2f.\n", spacing);
+      printf("Light position: (%.2f, %2.f, %.2f)\n", lightPosition[0], lightPosition[1], lightPosition[2]);
+      printf("Hilite color: (%.2f, %.2f, %.2f, %.2f)\n", hiliteColor[0], hiliteColor[1], hiliteColor[2], hiliteColor[3]);
+      printf("Camera position: (%.2f, %.2f, %.2f), Rotation: (%.2f, %.2f, %.2f)\n", camera_position[0], camera_position[1], camera_position[2], camera_rotation[0], camera_rotation[1], camera_rotation[2]);
+      get_frame_timer().print_stats();
+      printf("\n");
+    }
+
+    const char *get_diffraction_mode_name(diffraction_mode mode) {
+      switch (mode) {
+        case DIFFRACTION_AUTO: return "automatic";
+        case DIFFRACTION_VERTEX: return "vertex-based";
+        case DIFFRACTION_FRAGMENT: return "fragment-based";
+        case DIFFRACTION_SPECTRAL: return "spectral fragment-based";
+        default: return "lookup-texture-based";
       }
+    }
 
-      if (is_key_down('R') && !just_press_normals_visible) {
-        normals_visible = !normals_visible;
-        printf("Normals visible: %s.\n", normals_visible? "yes": "no");
-        just_press_normals_visible = true;
+    const char *get_model_name(model m) {
+      switch (m) {
+        case MODEL_CD: return "CD";
+        case MODEL_CUBE: return "cube";
+        default: return "shelf";
       }
-      if (!is_key_down('R')) {
-        just_press_normals_visible = false;
+    }
+
+    // approximate edge length in pixels of the triangles of a model.
+    // spreads the projected area of the bounding sphere over the front-facing half of the triangles.
+    float estimate_triangle_pixels(const aabb &model_bb, unsigned num_triangles, const vec3 &cameraPos) {
+      aabb bb = model_bb.get_transform(modelToWorld);
+      float radius = length(bb.get_half_extent());
+      float distance = length(bb.get_center() - cameraPos) - radius;
+      if (distance <= 0.1f || num_triangles == 0) {
+        // camera is inside the bounding sphere
+        return 1e6f;
       }
 
-      if (is_key_down('Y') && !just_press_tangents_visible) {
-        tangents_visible = !tangents_visible;
-        printf("Tangents visible: %s.\n", tangents_visible? "yes": "no");
-        just_press_tangents_visible = true;
+      // build_projection_matrix has a 90 degree field of view
+      int vx, vy;
+      get_viewport_size(vx, vy);
+      float radius_pixels = radius * (vy * 0.5f) / distance;
+      float area_pixels = 3.14159265f * radius_pixels * radius_pixels;
+      return sqrtf(area_pixels * 2.0f / num_triangles);
+    }
+
+    // pick the cheaper diffraction shader for a draw. Uses a little hysteresis
+    // so that the shader does not flicker at the threshold.
+    diffraction_mode select_diffraction_mode(const aabb &model_bb, unsigned num_triangles, const vec3 &cameraPos) {
+      float triangle_pixels = estimate_triangle_pixels(model_bb, num_triangles, cameraPos);
+      if (auto_diffraction_mode == DIFFRACTION_VERTEX) {
+        if (triangle_pixels > max_vertex_triangle_pixels * 1.25f) auto_diffraction_mode = DIFFRACTION_FRAGMENT;
+      } else {
+        if (triangle_pixels < max_vertex_triangle_pixels) auto_diffraction_mode = DIFFRACTION_VERTEX;
       }
-      if (!is_key_down('Y')) {
-        just_press_tangents_visible = false;
+      return auto_diffraction_mode;
+    }
+
+    // set up the diffraction shader for the current mode. The cube map must be bound to texture unit 0.
+    void renderDiffraction(const mat4t &modelToProjection, const mat3 &modelToWorldIT, vec3 &cameraPos, const aabb &model_bb, unsigned num_triangles) {
+      diffraction_mode mode = current_diffraction_mode;
+      if (mode == DIFFRACTION_AUTO) {
+        mode = select_diffraction_mode(model_bb, num_triangles, cameraPos);
       }
-      
-      if (is_key_down('J') && !just_press_show_help) {
-        show_help = !show_help;
-        just_press_show_help = true;
+
+      switch (mode) {
+        case DIFFRACTION_VERTEX: {
+          cubeMapVertexDifractionShader.get().render(modelToProjection, modelToWorld, modelToWorldIT, rough, spacing, hiliteColor, lightPosition, cameraPos, 0);
+        } break;
+        case DIFFRACTION_FRAGMENT: {
+          cubeMapDiffractionShader.get().render(modelToProjection, modelToWorld, modelToWorldIT, rough, spacing, hiliteColor, lightPosition, cameraPos, 0);
+        } break;
+        case DIFFRACTION_SPECTRAL: {
+          cubeMapSpectralDiffractionShader.get().render(modelToProjection, modelToWorld, modelToWorldIT, rough, spacing, hiliteColor, lightPosition, cameraPos, 0);
+        } break;
+        default: {
+          // only rebuilds the lookup texture when rough has changed
+          cubeMapLutDiffractionShader.update_lut(rough);
+          cubeMapLutDiffractionShader.render(modelToProjection, modelToWorld, modelToWorldIT, spacing, hiliteColor, lightPosition, cameraPos, 0, 1);
+        } break;
       }
-      if (!is_key_down('J')) {
-        just_press_show_help = false;
+    }
+
+    // the diffraction cube uses the corner positions as normals, so it shades like a sphere.
+    // each face is a quad of (pos, normal, tangent).
+    // this is static so that the offline renderer can build the same cube without GL.
+    static void addDiffractionCube(mesh_builder &mb) {
+      static const float vertices[] = {
+        1.0f,  1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 0.0f, 0.0f, 1.0f,
+        1.0f,  1.0f,  1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f,
+        1.0f, -1.0f,  1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f,
+        1.0f, -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 1.0f,
+
+        -1.0f,  1.0f,  1.0f, -1.0f, 1.0f, 1.0f, 0.0f, 0.0f, -1.0f,
+        -1.0f,  1.0f, -1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f, -1.0f,
+        -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, 0.0f, 0.0f, -1.0f,
+        -1.0f, -1.0f,  1.0f, -1.0f, -1.0f, 1.0f, 0.0f, 0.0f, -1.0f,
+
+        -1.0f,  1.0f, -1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 0.0f,
+        1.0f,  1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 0.0f,
+        1.0f,  1.0f,  1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f,
+        -1.0f,  1.0f,  1.0f, -1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f,
+
+        -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, 0.0f, 0.0f,
+        1.0f, -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, -1.0f, 0.0f, 0.0f,
+        1.0f, -1.0f,  1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f,
+        -1.0f, -1.0f,  1.0f, -1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f,
+        
+        1.0f,  1.0f,  1.0f, 1.0f, 1.0f, 1.0f, 0.0f, -1.0f, 0.0f,
+        -1.0f,  1.0f,  1.0f, -1.0f, 1.0f, 1.0f, 0.0f, -1.0f, 0.0f,
+        -1.0f, -1.0f,  1.0f, -1.0f, -1.0f, 1.0f, 0.0f, -1.0f, 0.0f,
+        1.0f, -1.0f,  1.0f, 1.0f, -1.0f, 1.0f, 0.0f, -1.0f, 0.0f,
+        
+        -1.0f,  1.0f, -1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
+        1.0f,  1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
+        1.0f, -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
+        -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, 0.0f, 1.0f, 0.0f
+      };
+
+      for (unsigned face = 0; face != 6; ++face) {
+        unsigned first = face * 4;
+        for (unsigned i = 0; i != 4; ++i) {
+          const float *v = vertices + (first + i) * 9;
+          mb.add_vertex(vec4(v[0], v[1], v[2], 1), vec4(v[3], v[4], v[5], 0), vec4(v[6], v[7], v[8], 0), 0, 0);
+        }
+        // the quads were drawn as triangle fans
+        mb.add_index(first + 0); mb.add_index(first + 1); mb.add_index(first + 2);
+        mb.add_index(first + 0); mb.add_index(first + 2); mb.add_index(first + 3);
       }
     }
 
+    void buildDiffractionCube() {
+      mesh_builder mb;
+      mb.init(24, 36);
+      addDiffractionCube(mb);
+      mb.get_mesh(diffraction_cube);
+    }
+
     void renderSky() {
       glDisable(GL_DEPTH_TEST);
       glDepthMask(false);
@@ -302,51 +547,8 @@ namespace octet {
 
       cubeMapSkyShader.render(&skyModelToProjection, &cameraPositionNormalized, 0);
 
-      float skyCubeVertices[] =
-      {    // x, y, z
-        1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f, -1.0f,
-
-        -1.0f, -1.0f,  1.0f,
-        -1.0f, -1.0f, -1.0f,
-        -1.0f,  1.0f, -1.0f,
-        -1.0f,  1.0f,  1.0f,
-        
-        -1.0f,  -1.0f, -1.0f,
-        1.0f,  -1.0f, -1.0f,
-        1.0f,  -1.0f,  1.0f,
-        -1.0f,  -1.0f,  1.0f,
-
-        -1.0f, 1.0f,  1.0f,
-        1.0f, 1.0f,  1.0f,
-        1.0f, 1.0f, -1.0f,
-        -1.0f, 1.0f, -1.0f,
-
-        1.0f, -1.0f,  1.0f,        
-        -1.0f, -1.0f,  1.0f,
-        -1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-
-        -1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-        1.0f,  1.0f, -1.0f,
-        -1.0f,  1.0f, -1.0f
-      };
-
-      glVertexAttribPointer(attribute_pos, 3, GL_FLOAT, GL_FALSE, 0, skyCubeVertices);
-
-      glEnableVertexAttribArray(attribute_pos);
+      sky_cube.render();
 
-      glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-      glDrawArrays(GL_TRIANGLE_FAN, 4, 4);
-      glDrawArrays(GL_TRIANGLE_FAN, 8, 4);
-      glDrawArrays(GL_TRIANGLE_FAN, 12, 4);
-      glDrawArrays(GL_TRIANGLE_FAN, 16, 4);
-      glDrawArrays(GL_TRIANGLE_FAN, 20, 4);
-
-      glDisableVertexAttribArray(attribute_pos);
       glDepthMask(true);
     }
 
@@ -366,7 +568,7 @@ namespace octet {
       modelToWorld.rotate(rotateAngle, 0.0f, 1.0f, 0.0f);
 
       mat4t modelToProjection = mat4t::build_projection_matrix(modelToWorld, cameraToWorld);
-      mat4t modelToWorldIT = modelToWorld.inverse4x4().transpose4x4();
+      mat3 modelToWorldIT = mat3::inverse3x3(modelToWorld);
 
       vec3 cameraPos = vec4(0.0f, 0.0f, 0.0f, 1.0f)*cameraToWorld;
 
@@ -374,62 +576,9 @@ namespace octet {
       glEnable(GL_TEXTURE_CUBE_MAP);
       glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMapTex);
       
-      if (is_frag_shader_mode) {
-        cubeMapDiffractionShader.render(modelToProjection, modelToWorld, modelToWorldIT, rough, spacing, hiliteColor, lightPosition, cameraPos, 0);
-      } else {
-        cubeMapVertexDifractionShader.render(modelToProjection, modelToWorld, modelToWorldIT, rough, spacing, hiliteColor, lightPosition, cameraPos, 0);
-      }
-
-      float vertices[] = {
-        1.0f,  1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 0.0f, 0.0f, 1.0f,
-        1.0f,  1.0f,  1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f,
-        1.0f, -1.0f,  1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f,
-        1.0f, -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 1.0f,
-
-        -1.0f,  1.0f,  1.0f, -1.0f, 1.0f, 1.0f, 0.0f, 0.0f, -1.0f,
-        -1.0f,  1.0f, -1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f, -1.0f,
-        -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, 0.0f, 0.0f, -1.0f,
-        -1.0f, -1.0f,  1.0f, -1.0f, -1.0f, 1.0f, 0.0f, 0.0f, -1.0f,
-
-        -1.0f,  1.0f, -1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 0.0f,
-        1.0f,  1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 0.0f,
-        1.0f,  1.0f,  1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f,
-        -1.0f,  1.0f,  1.0f, -1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f,
-
-        -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, 0.0f, 0.0f,
-        1.0f, -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, -1.0f, 0.0f, 0.0f,
-        1.0f, -1.0f,  1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f,
-        -1.0f, -1.0f,  1.0f, -1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f,
-        
-        1.0f,  1.0f,  1.0f, 1.0f, 1.0f, 1.0f, 0.0f, -1.0f, 0.0f,
-        -1.0f,  1.0f,  1.0f, -1.0f, 1.0f, 1.0f, 0.0f, -1.0f, 0.0f,
-        -1.0f, -1.0f,  1.0f, -1.0f, -1.0f, 1.0f, 0.0f, -1.0f, 0.0f,
-        1.0f, -1.0f,  1.0f, 1.0f, -1.0f, 1.0f, 0.0f, -1.0f, 0.0f,
-        
-        -1.0f,  1.0f, -1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
-        1.0f,  1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
-        1.0f, -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
-        -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, 0.0f, 1.0f, 0.0f
-      };
-
-      glVertexAttribPointer(attribute_pos, 3, GL_FLOAT, GL_FALSE, 9*sizeof(float), vertices);
-      glVertexAttribPointer(attribute_normal, 3, GL_FLOAT, GL_TRUE, 9*sizeof(float), vertices+3);
-      glVertexAttribPointer(attribute_tangent, 3, GL_FLOAT, GL_TRUE, 9*sizeof(float), vertices+6);
-
-      glEnableVertexAttribArray(attribute_pos);
-      glEnableVertexAttribArray(attribute_normal);
-      glEnableVertexAttribArray(attribute_tangent);
+      renderDiffraction(modelToProjection, modelToWorldIT, cameraPos, diffraction_cube.get_aabb(), diffraction_cube.get_num_indices() / 3);
 
-      glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-      glDrawArrays(GL_TRIANGLE_FAN, 4, 4);
-      glDrawArrays(GL_TRIANGLE_FAN, 8, 4);
-      glDrawArrays(GL_TRIANGLE_FAN, 12, 4);
-      glDrawArrays(GL_TRIANGLE_FAN, 16, 4);
-      glDrawArrays(GL_TRIANGLE_FAN, 20, 4);
-
-      glDisableVertexAttribArray(attribute_pos);
-      glDisableVertexAttribArray(attribute_normal);
-      glDisableVertexAttribArray(attribute_tangent);
+      diffraction_cube.render();
     }
 
     void renderCD() {
@@ -450,19 +599,22 @@ namespace octet {
       modelToWorld.rotate(rotateAngle, 0.0f, 1.0f, 0.0f);
 
       mat4t modelToProjection = mat4t::build_projection_matrix(modelToWorld, cameraToWorld);
-      mat4t modelToWorldIT = modelToWorld.inverse4x4().transpose4x4();
+      mat3 modelToWorldIT = mat3::inverse3x3(modelToWorld);
 
       glActiveTexture(GL_TEXTURE0);
       glEnable(GL_TEXTURE_CUBE_MAP);
       glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMapTex);
       
-      if (is_frag_shader_mode) {
-        cubeMapDiffractionShader.render(modelToProjection, modelToWorld, modelToWorldIT, rough, spacing, hiliteColor, lightPosition, cameraPos, 0);
-      } else {
-        cubeMapVertexDifractionShader.render(modelToProjection, modelToWorld, modelToWorldIT, rough, spacing, hiliteColor, lightPosition, cameraPos, 0);
-      }
+      // build_projection_matrix has a 90 degree field of view
+      int vx, vy;
+      get_viewport_size(vx, vy);
+      vec3 center = (vec4(0.0f, 0.0f, 0.0f, 1.0f)*modelToWorld).xyz();
+      float pixels_per_unit = vy * 0.5f / max(length(cameraPos - center), 0.1f);
+      cd_level = cd.select_level(pixels_per_unit, max_cd_edge_pixels);
 
-      ring.render();
+      renderDiffraction(modelToProjection, modelToWorldIT, cameraPos, cd.get_aabb(), cd.get_num_indices(cd_level) / 3);
+
+      cd.render(cd_level);
 
       if (normals_visible) {
         cshader.render(modelToProjection, vec4(0.0f, 0.0f, 1.0f, 1.0f));
@@ -475,50 +627,80 @@ namespace octet {
       }
     }
      
-    void renderHelp() {
+    // lay out the shelf of discs, each with its own angle, roughness, spacing and colour.
+    // the same seed is used every time so the discs keep their looks when the parameters change.
+    void buildShelf() {
+      random rnd(0x1234);
+      float pitch = 0.65f;
+      float x0 = -(shelf_columns - 1) * pitch * 0.5f;
+      float y0 = -(shelf_rows - 1) * pitch * 0.5f;
+
+      shelf.clear();
+      for (int j = 0; j != shelf_rows; ++j) {
+        for (int i = 0; i != shelf_columns; ++i) {
+          mat4t instanceToModel;
+          instanceToModel.loadIdentity();
+          instanceToModel.translate(x0 + i * pitch, y0 + j * pitch, 0.0f);
+          instanceToModel.rotateY(rnd.get(-30.0f, 30.0f));
+          instanceToModel.rotateX(rnd.get(-15.0f, 15.0f));
+          instanceToModel.scale(0.15f, 0.15f, 0.15f);
+
+          vec4 params(rough * rnd.get(0.75f, 1.25f), spacing * rnd.get(0.8f, 1.2f), 0.0f, 0.0f);
+          vec4 color = hiliteColor * vec4(rnd.get(0.8f, 1.2f), rnd.get(0.8f, 1.2f), rnd.get(0.8f, 1.2f), 1.0f);
+          shelf.add_instance(instanceToModel, params, color);
+        }
+      }
 
-      if (!show_help) return;
+      shelf_rough = rough;
+      shelf_spacing = spacing;
+      shelf_hiliteColor = hiliteColor;
+    }
 
-      glDisable(GL_DEPTH_TEST);
+    void renderShelf() {
+      if (rough != shelf_rough || spacing != shelf_spacing || any(hiliteColor != shelf_hiliteColor)) {
+        buildShelf();
+      }
+
+      glEnable(GL_TEXTURE_CUBE_MAP);
+      glEnable(GL_DEPTH_TEST);
 
       glBindBuffer(GL_ARRAY_BUFFER, 0);
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-      mat4t help_text_matrix;
-      help_text_matrix.loadIdentity();
+      cameraToWorld.loadIdentity();
+      cameraToWorld.rotate(camera_rotation[1], 0.0f, 1.0f, 0.0f);
+      cameraToWorld.rotate(camera_rotation[0], 1.0f, 0.0f, 0.0f);
+      cameraToWorld.translate(camera_position.x(), camera_position.y(), camera_position.z());
 
-      mat4t help_cam_matrix;
-      help_cam_matrix.loadIdentity();
+      vec3 cameraPos = (vec4(0.0f, 0.0f, 0.0f, 1.0f)*cameraToWorld).xyz();
 
-      mat4t modelToProjection = mat4t::build_projection_matrix(help_text_matrix, help_cam_matrix);
-      
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      modelToWorld.loadIdentity();
+      modelToWorld.rotate(rotateAngle, 0.0f, 1.0f, 0.0f);
 
-      tShader.render(modelToProjection, 0);
+      mat4t modelToProjection = mat4t::build_projection_matrix(modelToWorld, cameraToWorld);
 
       glActiveTexture(GL_TEXTURE0);
-      glDisable(GL_TEXTURE_CUBE_MAP);
-      glEnable(GL_TEXTURE_2D);
-      glBindTexture(GL_TEXTURE_2D, helpTex);
-      
-      float vertices[] = {
-        -0.9f,  -0.9f, -1.0f, 0.0f, 0.0f,
-        0.9f,  -0.9f,  -1.0f, 1.0f, 0.0f,
-        0.9f, -0.6f,  -1.0f, 1.0f, 1.0f,
-        -0.9f, -0.6f, -1.0f, 0.0f, 1.0f
-      };
+      glEnable(GL_TEXTURE_CUBE_MAP);
+      glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMapTex);
 
-      glVertexAttribPointer(attribute_pos, 3, GL_FLOAT, GL_FALSE, 5*sizeof(float), vertices);
-      glVertexAttribPointer(attribute_uv, 2, GL_FLOAT, GL_FALSE, 5*sizeof(float), vertices+3);
+      cubeMapInstancedDiffractionShader.render(modelToProjection, modelToWorld, lightPosition, cameraPos, 0);
 
-      glEnableVertexAttribArray(attribute_pos);
-      glEnableVertexAttribArray(attribute_uv);
+      shelf.render();
+    }
 
-      glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    void renderHelp() {
+
+      if (!show_help) return;
+
+      // the help image is drawn into the layer at its size on screen, so only resizes redraw it
+      int vx, vy;
+      get_viewport_size(vx, vy);
+      if (help_layer.begin_update((unsigned)(vx * 0.9f), (unsigned)(vy * 0.15f), 0)) {
+        ui_layer::draw_texture(tShader, helpTex, ui_layer::get_rect_matrix(-1, -1, 1, 1));
+        help_layer.end_update();
+      }
 
-      glDisableVertexAttribArray(attribute_pos);
-      glDisableVertexAttribArray(attribute_uv);
+      help_layer.composite(tShader, -0.9f, -0.9f, 0.9f, -0.6f);
     }
   };
 }
@@ -13,6 +13,9 @@
   #include "obb_test.h"
 #else
   #include "engine.h"
+  #include "offline_renderer.h"
+  #include "benchmark.h"
+  #include "ray_cast_benchmark.h"
 #endif
 
 //
@@ -24,11 +27,43 @@ int main(int argc, char **argv) {
   //octet::unit_test_ray();
 
   octet::app_utils::prefix("../../");
+
+  #if !defined(OCTET_OBB)
+    // layer2 --batch frames.txt renders the frames to files without opening a window
+    // layer2 --bench results.csv runs the shader benchmark instead of the viewer
+    // layer2 --ray-bench assets/Laurana50k.dae times mesh ray casts without opening a window
+    // layer2 --unlimited draws frames as fast as possible instead of at 60Hz
+    const char *bench_path = 0;
+    bool unlimited = false;
+    for (int i = 1; i < argc; ++i) {
+      if (!strcmp(argv[i], "--unlimited")) {
+        unlimited = true;
+      } else if (i + 1 == argc) {
+        break;
+      } else if (!strcmp(argv[i], "--batch")) {
+        return octet::offline_renderer::run(argv[i+1]);
+      } else if (!strcmp(argv[i], "--ray-bench")) {
+        return octet::ray_cast_benchmark::run(argv[i+1]);
+      } else if (!strcmp(argv[i], "--bench")) {
+        bench_path = argv[i+1];
+      }
+    }
+  #endif
+
   octet::app::init_all(argc, argv);
   #if defined(OCTET_OBB)
     octet::obb_test app(argc, argv);
   #else
+    if (bench_path) {
+      octet::benchmark bench(argc, argv, bench_path);
+      bench.init();
+      octet::app::run_all_apps();
+      return 0;
+    }
     octet::engine app(argc, argv);
+    if (unlimited) {
+      app.get_frame_timer().set_mode(octet::frame_timer::mode_unlimited);
+    }
   #endif
   app.init();
   octet::app::run_all_apps();
@@ -0,0 +1,398 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Ciro Duran, Bogdan Catana 2013, 2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Headless batch renderer for the diffraction shader.
+//
+
+namespace octet {
+  /*
+   * offline_renderer - renders frames described in a batch file to TGA images
+   * without a window or a GL context.
+   *
+   * The batch file has one "key=value" per line. "frame" ends a frame and starts the
+   * next one with the same settings, so only the changes need to be given.
+   * Lines starting with '#' are ignored.
+   *
+   *   out=frames/cd_000.tga   output file
+   *   size=640x480            image size
+   *   camera=0,0,3            camera position
+   *   rotation=0,0            camera rotation about x and y in degrees
+   *   angle=30                model rotation about y in degrees
+   *   rough=50                surface roughness (r)
+   *   spacing=10              groove spacing (d)
+   *   light=0,-0.17,0.98      light position
+   *   hilite=1,0.7,0.3,1      anisotropic highlight colour
+   *   model=cd                cd or cube
+   *   frame
+   *
+   * Matrices and defaults are the same as the engine's. The rasterizer only stores the
+   * world space position, normal and tangent of the nearest surface in each pixel; the
+   * covered pixels are then shaded four at a time by diffraction_reference, so frames
+   * can be compared with screen shots. The frames are independent and are rendered in parallel.
+   */
+  class offline_renderer {
+    enum model {
+      MODEL_CD,
+      MODEL_CUBE,
+      NUM_MODELS
+    };
+
+    struct frame {
+      char out[256];
+      unsigned width;
+      unsigned height;
+      vec3 camera_position;
+      vec3 camera_rotation;
+      float angle;
+      float rough;
+      float spacing;
+      vec3 lightPosition;
+      vec4 hiliteColor;
+      model current_model;
+    };
+
+    // world space surface attributes for one pixel, as the fragment shader sees them
+    struct surface {
+      vec3 position;
+      vec3 normal;
+      vec3 tangent;
+    };
+
+    // the nearest surface in every pixel
+    struct gbuffer {
+      dynarray<vec3> position;
+      dynarray<vec3> normal;
+      dynarray<vec3> tangent;
+      dynarray<float> depth;
+    };
+
+    dynarray<frame> frames;
+    cubemap_image sky;
+    mesh_builder models[NUM_MODELS];
+
+    static void set_defaults(frame &f) {
+      f.out[0] = 0;
+      f.width = 512;
+      f.height = 512;
+      f.camera_position = vec3(0.0f, 0.0f, 3.0f);
+      f.camera_rotation = vec3(0.0f, 0.0f, 0.0f);
+      f.angle = 0.0f;
+      f.rough = 50.0f;
+      f.spacing = 10.0f;
+      f.lightPosition = vec3(0.0f, -1.0f*sin(10*3.14159f/180.0f), 1.0f*cos(10*3.14159f/180.0f));
+      f.hiliteColor = vec4(1.0f, 0.7f, 0.3f, 1.0f);
+      f.current_model = MODEL_CD;
+    }
+
+    // apply one "key=value" line to a frame
+    static bool parse_line(frame &f, const char *key, const char *value) {
+      float x = 0, y = 0, z = 0, w = 0;
+      if (!strcmp(key, "out")) {
+        snprintf(f.out, sizeof(f.out), "%s", value);
+      } else if (!strcmp(key, "size")) {
+        unsigned sx = 0, sy = 0;
+        if (sscanf(value, "%ux%u", &sx, &sy) != 2 || !sx || !sy) return false;
+        f.width = sx;
+        f.height = sy;
+      } else if (!strcmp(key, "camera")) {
+        if (sscanf(value, "%f,%f,%f", &x, &y, &z) != 3) return false;
+        f.camera_position = vec3(x, y, z);
+      } else if (!strcmp(key, "rotation")) {
+        if (sscanf(value, "%f,%f", &x, &y) != 2) return false;
+        f.camera_rotation = vec3(x, y, 0.0f);
+      } else if (!strcmp(key, "angle")) {
+        if (sscanf(value, "%f", &f.angle) != 1) return false;
+      } else if (!strcmp(key, "rough")) {
+        if (sscanf(value, "%f", &f.rough) != 1) return false;
+      } else if (!strcmp(key, "spacing")) {
+        if (sscanf(value, "%f", &f.spacing) != 1) return false;
+      } else if (!strcmp(key, "light")) {
+        if (sscanf(value, "%f,%f,%f", &x, &y, &z) != 3) return false;
+        f.lightPosition = vec3(x, y, z);
+      } else if (!strcmp(key, "hilite")) {
+        if (sscanf(value, "%f,%f,%f,%f", &x, &y, &z, &w) != 4) return false;
+        f.hiliteColor = vec4(x, y, z, w);
+      } else if (!strcmp(key, "model")) {
+        if (!strcmp(value, "cd")) f.current_model = MODEL_CD;
+        else if (!strcmp(value, "cube")) f.current_model = MODEL_CUBE;
+        else return false;
+      } else {
+        return false;
+      }
+      return true;
+    }
+
+    // what the sky box shows through each pixel. the sky camera only rotates.
+    void render_sky(const frame &f, vec4 *color) const {
+      mat4t skyCameraToWorld;
+      skyCameraToWorld.loadIdentity();
+      skyCameraToWorld.rotate(f.camera_rotation[1], 0.0f, 1.0f, 0.0f);
+      skyCameraToWorld.rotate(f.camera_rotation[0], 1.0f, 0.0f, 0.0f);
+
+      // build_projection_matrix has a 90 degree frustum, so ndc (x, y) is the view ray (x, y, -1)
+      for (unsigned j = 0; j != f.height; ++j) {
+        float ndc_y = (j + 0.5f) * 2.0f / f.height - 1.0f;
+        for (unsigned i = 0; i != f.width; ++i) {
+          float ndc_x = (i + 0.5f) * 2.0f / f.width - 1.0f;
+          vec3 dir = (vec4(ndc_x, ndc_y, -1.0f, 0.0f) * skyCameraToWorld).xyz();
+          color[j * f.width + i] = sky.sample(dir);
+        }
+      }
+    }
+
+    // scan convert the model with a z buffer, keeping the surface of the nearest triangle
+    void rasterize(const frame &f, const mat4t &modelToWorld, const mat4t &cameraToWorld, gbuffer &gb) const {
+      mat4t modelToProjection = mat4t::build_projection_matrix(modelToWorld, cameraToWorld);
+      mat3 modelToWorldIT = mat3::inverse3x3(modelToWorld);
+
+      const mesh_builder &mb = models[f.current_model];
+      float fw = (float)f.width, fh = (float)f.height;
+
+      for (unsigned t = 0; t + 2 < mb.get_num_indices(); t += 3) {
+        vec4 clip[3];
+        surface attr[3];
+        bool visible = true;
+        for (unsigned k = 0; k != 3; ++k) {
+          unsigned index = mb.get_index(t + k);
+          const float *p = mb.get_pos(index);
+          const float *n = mb.get_normal(index);
+          const float *tn = mb.get_tangent(index);
+          clip[k] = vec4(p[0], p[1], p[2], 1.0f) * modelToProjection;
+          attr[k].position = (vec4(p[0], p[1], p[2], 1.0f) * modelToWorld).xyz();
+          // modelToWorldIT * normal in GLSL, with the matrix uploaded row major
+          attr[k].normal = vec3(0.0f, 0.0f, 0.0f);
+          attr[k].tangent = vec3(0.0f, 0.0f, 0.0f);
+          for (int i = 0; i != 3; ++i) {
+            for (int j = 0; j != 3; ++j) {
+              attr[k].normal[i] += n[j] * modelToWorldIT(j, i);
+              attr[k].tangent[i] += tn[j] * modelToWorldIT(j, i);
+            }
+          }
+          // there is no clipper, so drop triangles that reach the near plane
+          if (clip[k][3] < 0.1f) visible = false;
+        }
+        if (!visible) continue;
+
+        float sx[3], sy[3], sz[3], rw[3];
+        for (unsigned k = 0; k != 3; ++k) {
+          rw[k] = 1.0f / clip[k][3];
+          sx[k] = (clip[k][0] * rw[k] * 0.5f + 0.5f) * fw;
+          sy[k] = (clip[k][1] * rw[k] * 0.5f + 0.5f) * fh;
+          sz[k] = clip[k][2] * rw[k];
+        }
+
+        float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+        if (area == 0) continue;
+        float rarea = 1.0f / area;
+
+        int x0 = max(0, (int)floorf(min(sx[0], min(sx[1], sx[2]))));
+        int x1 = min((int)f.width - 1, (int)ceilf(max(sx[0], max(sx[1], sx[2]))));
+        int y0 = max(0, (int)floorf(min(sy[0], min(sy[1], sy[2]))));
+        int y1 = min((int)f.height - 1, (int)ceilf(max(sy[0], max(sy[1], sy[2]))));
+
+        for (int y = y0; y <= y1; ++y) {
+          float py = y + 0.5f;
+          for (int x = x0; x <= x1; ++x) {
+            float px = x + 0.5f;
+            // barycentric coordinates, either winding (the shaders do not cull)
+            float b0 = ((sx[1] - px) * (sy[2] - py) - (sx[2] - px) * (sy[1] - py)) * rarea;
+            float b1 = ((sx[2] - px) * (sy[0] - py) - (sx[0] - px) * (sy[2] - py)) * rarea;
+            float b2 = 1.0f - b0 - b1;
+            if (b0 < 0 || b1 < 0 || b2 < 0) continue;
+
+            unsigned pixel = y * f.width + x;
+            float z = b0 * sz[0] + b1 * sz[1] + b2 * sz[2];
+            if (z >= gb.depth[pixel]) continue;
+            gb.depth[pixel] = z;
+
+            // perspective correct varyings
+            float p0 = b0 * rw[0], p1 = b1 * rw[1], p2 = b2 * rw[2];
+            float rp = 1.0f / (p0 + p1 + p2);
+            p0 *= rp; p1 *= rp; p2 *= rp;
+            gb.position[pixel] = attr[0].position * p0 + attr[1].position * p1 + attr[2].position * p2;
+            gb.normal[pixel] = attr[0].normal * p0 + attr[1].normal * p1 + attr[2].normal * p2;
+            gb.tangent[pixel] = attr[0].tangent * p0 + attr[1].tangent * p1 + attr[2].tangent * p2;
+          }
+        }
+      }
+    }
+
+    // shade the covered pixels with the CPU diffraction shader
+    void render_model(const frame &f, vec4 *color) const {
+      mat4t cameraToWorld;
+      cameraToWorld.loadIdentity();
+      cameraToWorld.rotate(f.camera_rotation[1], 0.0f, 1.0f, 0.0f);
+      cameraToWorld.rotate(f.camera_rotation[0], 1.0f, 0.0f, 0.0f);
+      cameraToWorld.translate(f.camera_position.x(), f.camera_position.y(), f.camera_position.z());
+
+      mat4t modelToWorld;
+      modelToWorld.loadIdentity();
+      modelToWorld.rotate(f.angle, 0.0f, 1.0f, 0.0f);
+
+      unsigned num_pixels = f.width * f.height;
+      gbuffer gb;
+      gb.position.resize(num_pixels);
+      gb.normal.resize(num_pixels);
+      gb.tangent.resize(num_pixels);
+      gb.depth.resize(num_pixels);
+      for (unsigned i = 0; i != num_pixels; ++i) {
+        gb.depth[i] = 1.0f;
+      }
+
+      rasterize(f, modelToWorld, cameraToWorld, gb);
+
+      diffraction_reference::params params;
+      params.rough = f.rough;
+      params.spacing = f.spacing;
+      params.hiliteColor = f.hiliteColor;
+      params.lightPosition = f.lightPosition;
+      params.cameraPosition = (vec4(0.0f, 0.0f, 0.0f, 1.0f)*cameraToWorld).xyz();
+      params.num_orders = 7;
+
+      // pack the covered pixels so that every group of four is full
+      dynarray<unsigned> covered;
+      covered.reserve(num_pixels);
+      for (unsigned i = 0; i != num_pixels; ++i) {
+        if (gb.depth[i] < 1.0f) {
+          gb.position[covered.size()] = gb.position[i];
+          gb.normal[covered.size()] = gb.normal[i];
+          gb.tangent[covered.size()] = gb.tangent[i];
+          covered.push_back(i);
+        }
+      }
+      if (!covered.size()) return;
+
+      dynarray<vec4> shaded(covered.size());
+      diffraction_reference::shade(&shaded[0], &gb.position[0], &gb.normal[0], &gb.tangent[0], covered.size(), params, sky);
+      for (unsigned i = 0; i != covered.size(); ++i) {
+        color[covered[i]] = shaded[i];
+      }
+    }
+
+    // uncompressed 24 bit TGA, bottom row first like the GL frame buffer
+    static bool write_tga(const char *path, const vec4 *color, unsigned width, unsigned height) {
+      FILE *file = fopen(path, "wb");
+      if (!file) return false;
+
+      uint8_t header[18] = { 0 };
+      header[2] = 2;
+      header[12] = (uint8_t)width; header[13] = (uint8_t)(width >> 8);
+      header[14] = (uint8_t)height; header[15] = (uint8_t)(height >> 8);
+      header[16] = 24;
+      fwrite(header, 1, sizeof(header), file);
+
+      dynarray<uint8_t> row(width * 3);
+      for (unsigned j = 0; j != height; ++j) {
+        for (unsigned i = 0; i != width; ++i) {
+          const vec4 &c = color[j * width + i];
+          row[i*3+0] = (uint8_t)(c[2] * 255.0f + 0.5f);
+          row[i*3+1] = (uint8_t)(c[1] * 255.0f + 0.5f);
+          row[i*3+2] = (uint8_t)(c[0] * 255.0f + 0.5f);
+        }
+        fwrite(&row[0], 1, width * 3, file);
+      }
+      fclose(file);
+      return true;
+    }
+
+    void render_frame(unsigned index) const {
+      const frame &f = frames[index];
+      dynarray<vec4> color(f.width * f.height);
+      render_sky(f, &color[0]);
+      render_model(f, &color[0]);
+
+      if (write_tga(f.out, &color[0], f.width, f.height)) {
+        printf("%s\n", f.out);
+      } else {
+        printf("warning: could not write %s\n", f.out);
+      }
+    }
+
+    static void render_frame_fn(void *context, unsigned index) {
+      ((const offline_renderer*)context)->render_frame(index);
+    }
+
+  public:
+    offline_renderer() {
+    }
+
+    // read the frames from a batch file
+    bool load_batch(const char *path) {
+      FILE *file = fopen(path, "rb");
+      if (!file) {
+        printf("warning: could not open batch file %s\n", path);
+        return false;
+      }
+
+      frame cur;
+      set_defaults(cur);
+      frames.reset();
+
+      char line[512];
+      for (unsigned line_number = 1; fgets(line, sizeof(line), file); ++line_number) {
+        // strip the end of line and leading blanks
+        char *src = line;
+        while (*src == ' ' || *src == '\t') ++src;
+        size_t len = strlen(src);
+        while (len && (src[len-1] == '\n' || src[len-1] == '\r' || src[len-1] == ' ')) src[--len] = 0;
+        if (!len || src[0] == '#') continue;
+
+        if (!strcmp(src, "frame")) {
+          if (!cur.out[0]) {
+            printf("warning: %s(%d): frame has no out= file\n", path, line_number);
+          } else {
+            frames.push_back(cur);
+          }
+          continue;
+        }
+
+        char *eq = strchr(src, '=');
+        if (eq) *eq = 0;
+        if (!eq || !parse_line(cur, src, eq + 1)) {
+          printf("warning: %s(%d): bad line\n", path, line_number);
+        }
+      }
+      fclose(file);
+      return frames.size() != 0;
+    }
+
+    // load the sky and the models. they are shared read-only by the frames.
+    bool init() {
+      if (!sky.load(
+        "assets/cubemaps/Tenerife4/posx.jpg", "assets/cubemaps/Tenerife4/posy.jpg", "assets/cubemaps/Tenerife4/posz.jpg",
+        "assets/cubemaps/Tenerife4/negx.jpg", "assets/cubemaps/Tenerife4/negy.jpg", "assets/cubemaps/Tenerife4/negz.jpg"
+      )) {
+        return false;
+      }
+
+      models[MODEL_CD].add_one_CD(0.3f, 2.0f, 1.0f, 1.0f);
+      models[MODEL_CUBE].init(24, 36);
+      engine::addDiffractionCube(models[MODEL_CUBE]);
+      return true;
+    }
+
+    // render all the frames, num_threads = 0 uses every cpu
+    void render(unsigned num_threads = 0) {
+      thread_pool::for_each(frames.size(), render_frame_fn, this, num_threads);
+    }
+
+    unsigned get_num_frames() const {
+      return frames.size();
+    }
+
+    // run a batch file from the command line. returns the exit code.
+    static int run(const char *batch_path) {
+      offline_renderer renderer;
+      if (!renderer.load_batch(batch_path) || !renderer.init()) {
+        return 1;
+      }
+      double start = app::get_time();
+      renderer.render();
+      printf("%d frames in %.2fs\n", renderer.get_num_frames(), app::get_time() - start);
+      return 0;
+    }
+  };
+}
@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Micro benchmark for mesh::ray_cast
+//
+
+namespace octet {
+  /*
+   * ray_cast_benchmark - times mesh::ray_cast, which tests the triangles of each bvh leaf
+   * four at a time, against mesh::ray_cast_scalar, which tests them one at a time, on a
+   * collada mesh (eg. assets/Laurana50k.dae). It runs from main() before any window exists;
+   * this works because gl_resource only makes its GL buffers on the first bind, and the
+   * mesh is never drawn.
+   *
+   * The rays go from random points around the mesh's box to random points inside it, so
+   * most of them hit. Each kernel casts every ray num_passes times and the fastest pass
+   * is reported. The results of the two kernels are then compared: the triangle, t and
+   * the barycentric numerators and denominator should be exactly the same.
+   */
+  class ray_cast_benchmark {
+    enum { num_passes = 5 };
+
+    struct result {
+      bool hit;
+      float t;
+      int indices[3];
+      vec4 numer;
+      float denom;
+    };
+
+    mesh model;
+    dynarray<vec3> starts;
+    dynarray<vec3> distances;
+    dynarray<result> scalar_results;
+    dynarray<result> packet_results;
+
+    bool load(const char *url, const char *mesh_id) {
+      collada_builder builder;
+      if (!builder.load_xml(url)) {
+        printf("ray_cast_benchmark: could not load %s\n", url);
+        return false;
+      }
+      resources dict;
+      builder.get_mesh(model, mesh_id, dict);
+      if (model.get_num_indices() == 0) {
+        printf("ray_cast_benchmark: no mesh %s in %s\n", mesh_id, url);
+        return false;
+      }
+      return true;
+    }
+
+    void make_rays(unsigned num_rays) {
+      random rand;
+      // the mesh aabb may not have been set by the loader
+      aabb bb = model.get_triangle_bvh().get_bounds();
+      vec3 center = bb.get_center();
+      vec3 half = bb.get_half_extent();
+      float radius = half.length() * 2;
+
+      starts.resize(num_rays);
+      distances.resize(num_rays);
+      for (unsigned i = 0; i != num_rays; ++i) {
+        vec3 dir = vec3(rand.get(-1.0f, 1.0f), rand.get(-1.0f, 1.0f), rand.get(-1.0f, 1.0f));
+        dir = dir.squared() > 1e-6f ? dir.normalize() : vec3(0, 0, 1);
+        vec3 target = center + half * vec3(rand.get(-1.0f, 1.0f), rand.get(-1.0f, 1.0f), rand.get(-1.0f, 1.0f));
+        starts[i] = center + dir * radius;
+        distances[i] = (target - starts[i]) * 2.0f;
+      }
+    }
+
+    // the fastest of num_passes passes over all the rays, in seconds
+    double run_kernel(bool packets, dynarray<result> &results) {
+      unsigned num_rays = starts.size();
+      results.resize(num_rays);
+      double best = 1e9;
+      for (unsigned pass = 0; pass != num_passes; ++pass) {
+        double start = app::get_time();
+        for (unsigned i = 0; i != num_rays; ++i) {
+          result &r = results[i];
+          r.t = 1.0f;
+          if (packets) {
+            r.hit = model.ray_cast(starts[i], distances[i], r.t, r.indices, r.numer, r.denom);
+          } else {
+            r.hit = model.ray_cast_scalar(starts[i], distances[i], r.t, r.indices, r.numer, r.denom);
+          }
+        }
+        double time = app::get_time() - start;
+        best = time < best ? time : best;
+      }
+      return best;
+    }
+
+    static bool same(const result &a, const result &b) {
+      if (a.hit != b.hit) return false;
+      if (!a.hit) return true;
+      return
+        a.t == b.t && a.denom == b.denom &&
+        a.indices[0] == b.indices[0] && a.indices[1] == b.indices[1] && a.indices[2] == b.indices[2] &&
+        a.numer[0] == b.numer[0] && a.numer[1] == b.numer[1] && a.numer[2] == b.numer[2] && a.numer[3] == b.numer[3]
+      ;
+    }
+
+  public:
+    // returns 0 if the two kernels agree on every ray
+    static int run(const char *url, const char *mesh_id = "shape0-lib", unsigned num_rays = 100000) {
+      ray_cast_benchmark bench;
+      if (!bench.load(url, mesh_id)) {
+        return 1;
+      }
+
+      double start = app::get_time();
+      bench.model.get_triangle_bvh();
+      double build_time = app::get_time() - start;
+
+      bench.make_rays(num_rays);
+      double scalar_time = bench.run_kernel(false, bench.scalar_results);
+      double packet_time = bench.run_kernel(true, bench.packet_results);
+
+      unsigned num_hits = 0, num_different = 0;
+      for (unsigned i = 0; i != num_rays; ++i) {
+        num_hits += bench.scalar_results[i].hit;
+        num_different += !same(bench.scalar_results[i], bench.packet_results[i]);
+      }
+
+      printf("%s: %d triangles, bvh built in %.2fms\n", url, bench.model.get_num_indices() / 3, build_time * 1000);
+      printf("%d rays, %d hits\n", num_rays, num_hits);
+      printf("scalar: %.2fms (%.2f Mrays/s)\n", scalar_time * 1000, num_rays / scalar_time * 1e-6);
+      printf("packet: %.2fms (%.2f Mrays/s), %.2fx\n", packet_time * 1000, num_rays / packet_time * 1e-6, scalar_time / packet_time);
+      printf("%d different results\n", num_different);
+      return num_different ? 1 : 0;
+    }
+  };
+}
@@ -4,14 +4,28 @@
 //
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
-// mouse ball for rotating cameras around points of interest.
+// click on mesh instances to select them.
 
 namespace octet {
   class object_picker {
     app *the_app;
     dynarray<ref<mesh_instance> > objects;
+
+    // the last instance clicked on, drawn with its bounding box
+    ref<mesh_instance> picked;
+    vec3 picked_pos;
   public:
     object_picker() {
+      the_app = 0;
+    }
+
+    mesh_instance *get_picked() const {
+      return picked;
+    }
+
+    // world position of the last pick
+    vec3 get_picked_pos() const {
+      return picked_pos;
     }
 
     void init(app *the_app) {
@@ -38,7 +52,13 @@ namespace octet {
 
         scene::cast_result res;
         the_scene->cast_ray(res, the_ray);
+        if (picked) {
+          picked->set_flags(picked->get_flags() & ~mesh_instance::flag_selected);
+        }
+        picked = res.mi;
         if (res.mi) {
+          res.mi->set_flags(res.mi->get_flags() | mesh_instance::flag_selected);
+          picked_pos = res.pos;
           //printf("%s\n", res.depth.toString());
         }
       }
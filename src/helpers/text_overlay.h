@@ -5,56 +5,57 @@
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
 //
-// scene for rendering text overlays
+// text overlays cached in a ui_layer
 
 namespace octet {
   class text_overlay {
-    ref<scene> text_scene;
-    ref<camera_instance> cam;
-    ref<mesh_instance> msh_inst;
-    ref<mesh_text> text;
+    ui_layer layer;
+    ref<image> page;
+    ref<bitmap_font> font;
+    string text;
 
   public:
-    void init() {
-      // Make a scene for the text overlay using an ortho camera
-      // that works in screen pixels.
-      text_scene = new scene();
-
-      image *page = new image("assets/courier_18_0.gif");
+    void init(const char *page_url = "assets/courier_18_0.gif", const char *fnt_url = "assets/courier_18.fnt") {
+      page = new image(page_url);
       page->load();
-      bitmap_font *font = new bitmap_font(
-        page->get_width(), page->get_height(), "assets/courier_18.fnt"
-      );
-
-      /*static const char sample_text[] =
-        "Antonio: Where is the master, boatswain?\n"
-        "Boatswain: Do you not hear him? You mar our labour: keep your cabins; you do assist the storm.\n"
-        "Gonzalo: Nay, good, be patient.\n"
-        "Boatswain: When the sea is. Hence! What cares these roarers for the name of king? To cabin! silence! Trouble us not.\n"
-        "Gonzalo: Good, yet remember whom thou hast aboard.\n"
-        "Boatswain: None that I more love than myself. You are counsellor;  if you can command these elements to silence, and work the peace of the present, we will not hand a rope more. Use your authority; if you cannot, give thanks you have liv'd so long, and make yourself ready in your cabin for the mischance of the hour, if it so hap.\n"
-      ;*/
-
-      aabb bb(vec3(0, 0, 0), vec3(64, 256, 0));
-      text = new mesh_text(font, "Hello", &bb);
-
-      scene_node *msh_node = text_scene->add_scene_node();
-      material *mat = new material(page);
-      msh_inst = new mesh_instance(msh_node, text, mat);
-      text_scene->add_mesh_instance(msh_inst);
-
-      text_scene->create_default_camera_and_lights();
-      cam = text_scene->get_camera_instance(0);
-      cam->get_node()->access_nodeToParent().loadIdentity();
+      font = new bitmap_font(page->get_width(), page->get_height(), fnt_url);
+      text = "Hello";
+    }
+
+    // the layer is only redrawn when the text changes
+    void set_text(const char *new_text) {
+      text = new_text;
     }
 
-    void render(bump_shader &object_shader, bump_shader &skin_shader, int vx, int vy, int frame_number) {
-      cam->set_ortho((float)vx, (float)vy, 1, -1, 1);
-      camera_instance *cam = text_scene->get_camera_instance(0);
-      text_scene->set_dump_vertices(frame_number == 0);
+    // draw the text in a box of width x height pixels at the top left of a vx x vy viewport
+    void render(texture_shader &shader, int vx, int vy, int width = 256, int height = 64) {
+      if (!font || vx <= 0 || vy <= 0) return;
+
+      if (layer.begin_update(width, height, ui_layer::get_key(text.c_str()))) {
+        enum { max_quads = 256 };
+        dynarray<bitmap_font::vertex> vertices(max_quads * 4);
+        dynarray<uint32_t> indices(max_quads * 6);
+        aabb bb(vec3(width * 0.5f, height * 0.5f, 0.0f), vec3(width * 0.5f, height * 0.5f, 0.0f));
+        unsigned num_quads = font->build_mesh(bb, vertices.data(), indices.data(), max_quads, text.c_str(), 0);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, page->get_gl_texture());
+        shader.render(layer.get_pixel_to_projection(), 0);
 
-      text_scene->render(object_shader, skin_shader, *cam, 1);
+        glVertexAttribPointer(attribute_pos, 3, GL_FLOAT, GL_FALSE, sizeof(bitmap_font::vertex), (void*)&vertices[0].x );
+        glEnableVertexAttribArray(attribute_pos);
+        glVertexAttribPointer(attribute_uv, 3, GL_FLOAT, GL_FALSE, sizeof(bitmap_font::vertex), (void*)&vertices[0].u );
+        glEnableVertexAttribArray(attribute_uv);
+
+        glDrawElements(GL_TRIANGLES, num_quads * 6, GL_UNSIGNED_INT, indices.data());
+
+        glDisableVertexAttribArray(attribute_pos);
+        glDisableVertexAttribArray(attribute_uv);
+        layer.end_update();
+      }
+
+      float x1 = -1 + 2.0f * width / vx, y0 = 1 - 2.0f * height / vy;
+      layer.composite(shader, -1, y0, x1, 1);
     }
   };
 }
-
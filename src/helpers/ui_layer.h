@@ -0,0 +1,200 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// overlays drawn once into a texture and composited every frame
+//
+
+namespace octet {
+  /*
+   * ui_layer - caches a 2D overlay (help, scores, text) in a texture.
+   *
+   * Each frame, call begin_update with the size of the layer in pixels and a key made
+   * from its contents (eg. get_key(text)). It only returns true when the size or the key
+   * has changed; then draw the contents, which go to the layer's framebuffer, and call
+   * end_update. composite() draws the cached texture over the frame with one draw from
+   * a static vertex buffer.
+   *
+   * The layer holds premultiplied alpha, so blended contents composite exactly as if
+   * they had been drawn straight onto the frame.
+   */
+  class ui_layer {
+    GLuint texture;
+    GLuint framebuffer;
+
+    // a unit square with uvs, shared by all layers
+    static GLuint get_quad() {
+      static GLuint quad;
+      if (!quad) {
+        static const float vertices[] = {
+          0, 0, 0, 0, 0,
+          1, 0, 0, 1, 0,
+          1, 1, 0, 1, 1,
+          0, 1, 0, 0, 1,
+        };
+        glGenBuffers(1, &quad);
+        glBindBuffer(GL_ARRAY_BUFFER, quad);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+      }
+      return quad;
+    }
+
+    unsigned width;
+    unsigned height;
+    uint32_t key;
+    bool valid;
+
+    // the state to go back to in end_update
+    GLint saved_framebuffer;
+    GLint saved_viewport[4];
+
+    void release() {
+      if (framebuffer) glDeleteFramebuffers(1, &framebuffer);
+      if (texture) glDeleteTextures(1, &texture);
+      framebuffer = texture = 0;
+    }
+
+    void allocate(unsigned new_width, unsigned new_height) {
+      release();
+      width = new_width;
+      height = new_height;
+
+      glGenTextures(1, &texture);
+      glBindTexture(GL_TEXTURE_2D, texture);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+      glGenFramebuffers(1, &framebuffer);
+      glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+      if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("warning: ui_layer framebuffer %dx%d is not complete\n", width, height);
+      }
+      glBindFramebuffer(GL_FRAMEBUFFER, saved_framebuffer);
+    }
+
+  public:
+    ui_layer() {
+      texture = framebuffer = 0;
+      width = height = 0;
+      key = 0;
+      valid = false;
+      saved_framebuffer = 0;
+      memset(saved_viewport, 0, sizeof(saved_viewport));
+    }
+
+    ~ui_layer() {
+      release();
+    }
+
+    // 32 bit FNV-1a of a string, for keys. chain calls to combine several strings.
+    static uint32_t get_key(const char *text, uint32_t key = 0x811c9dc5) {
+      for (const char *p = text; *p; ++p) {
+        key = (key ^ (uint8_t)*p) * 0x01000193;
+      }
+      return key;
+    }
+
+    // the next begin_update will redraw the layer
+    void invalidate() {
+      valid = false;
+    }
+
+    // if the layer is out of date, start drawing into it and return true.
+    // the layer is cleared to transparent and the viewport covers it.
+    bool begin_update(unsigned new_width, unsigned new_height, uint32_t new_key) {
+      new_width = new_width ? new_width : 1;
+      new_height = new_height ? new_height : 1;
+      if (valid && new_width == width && new_height == height && new_key == key) {
+        return false;
+      }
+
+      glGetIntegerv(GL_FRAMEBUFFER_BINDING, &saved_framebuffer);
+      glGetIntegerv(GL_VIEWPORT, saved_viewport);
+      if (new_width != width || new_height != height || !texture) {
+        allocate(new_width, new_height);
+      }
+      key = new_key;
+      valid = true;
+
+      glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+      glViewport(0, 0, width, height);
+      glClearColor(0, 0, 0, 0);
+      glClear(GL_COLOR_BUFFER_BIT);
+
+      // keep the colours premultiplied by alpha, see composite
+      glDisable(GL_DEPTH_TEST);
+      glEnable(GL_BLEND);
+      glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+      return true;
+    }
+
+    void end_update() {
+      glBindFramebuffer(GL_FRAMEBUFFER, saved_framebuffer);
+      glViewport(saved_viewport[0], saved_viewport[1], saved_viewport[2], saved_viewport[3]);
+    }
+
+    // while updating, this maps pixels in the layer, from the bottom left, to the projection
+    mat4t get_pixel_to_projection() const {
+      mat4t result;
+      result.loadIdentity();
+      result.ortho(0, (float)width, 0, (float)height, -1, 1);
+      return result;
+    }
+
+    GLuint get_texture() const {
+      return texture;
+    }
+
+    // draw a texture over the unit square transformed by modelToProjection.
+    // also used to draw images into a layer while updating it.
+    static void draw_texture(texture_shader &shader, GLuint tex, const mat4t &modelToProjection) {
+      shader.render(modelToProjection, 0);
+
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, tex);
+
+      glBindBuffer(GL_ARRAY_BUFFER, get_quad());
+      glVertexAttribPointer(attribute_pos, 3, GL_FLOAT, GL_FALSE, 5*sizeof(float), (void*)0);
+      glVertexAttribPointer(attribute_uv, 2, GL_FLOAT, GL_FALSE, 5*sizeof(float), (void*)(3*sizeof(float)));
+      glEnableVertexAttribArray(attribute_pos);
+      glEnableVertexAttribArray(attribute_uv);
+
+      glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+      glDisableVertexAttribArray(attribute_pos);
+      glDisableVertexAttribArray(attribute_uv);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // matrix that maps the unit square to a rectangle in projection space, eg. (-1, -1) to (1, 1) for the whole screen
+    static mat4t get_rect_matrix(float x0, float y0, float x1, float y1) {
+      mat4t result;
+      result.loadIdentity();
+      result.translate(x0, y0, 0);
+      result.scale(x1 - x0, y1 - y0, 1);
+      return result;
+    }
+
+    // draw the layer over the unit square transformed by modelToProjection.
+    // leaves depth testing off and premultiplied blending on.
+    void composite(texture_shader &shader, const mat4t &modelToProjection) {
+      if (!valid) return;
+      glDisable(GL_DEPTH_TEST);
+      glEnable(GL_BLEND);
+      glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+      draw_texture(shader, texture, modelToProjection);
+    }
+
+    // draw the layer over a rectangle in projection space
+    void composite(texture_shader &shader, float x0, float y0, float x1, float y1) {
+      composite(shader, get_rect_matrix(x0, y0, x1, y1));
+    }
+  };
+}
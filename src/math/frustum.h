@@ -0,0 +1,119 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// View frustum for culling
+//
+
+namespace octet {
+  // The six planes of a view frustum. Used to skip objects that are off the screen.
+  class frustum {
+    enum { num_planes = 6 };
+
+    // plane i is (x, y, z, w) where x * px + y * py + z * pz + w >= 0 inside the frustum.
+    // the planes are not normalized; the tests do not need them to be.
+    vec4 planes[num_planes];
+
+  public:
+    frustum() {
+    }
+
+    frustum(const mat4t &worldToProjection) {
+      init(worldToProjection);
+    }
+
+    // extract the planes from a world to projection matrix (row vectors, so clip = pos * m)
+    // inside means -w <= x, y, z <= w in clip space.
+    void init(const mat4t &m) {
+      vec4 cx(m[0][0], m[1][0], m[2][0], m[3][0]);
+      vec4 cy(m[0][1], m[1][1], m[2][1], m[3][1]);
+      vec4 cz(m[0][2], m[1][2], m[2][2], m[3][2]);
+      vec4 cw(m[0][3], m[1][3], m[2][3], m[3][3]);
+      planes[0] = cw + cx;
+      planes[1] = cw - cx;
+      planes[2] = cw + cy;
+      planes[3] = cw - cy;
+      planes[4] = cw + cz;
+      planes[5] = cw - cz;
+    }
+
+    const vec4 &get_plane(int i) const {
+      return planes[i];
+    }
+
+    // true if any part of the box may be inside the frustum.
+    // boxes near the corners can pass without being visible, but no visible box fails.
+    bool intersects(const aabb &bb) const {
+      vec3 c = bb.get_center();
+      vec3 h = bb.get_half_extent();
+      for (int i = 0; i != num_planes; ++i) {
+        const vec4 &p = planes[i];
+        float dist = c.x() * p.x() + c.y() * p.y() + c.z() * p.z() + p.w();
+        float radius = h.x() * fabsf(p.x()) + h.y() * fabsf(p.y()) + h.z() * fabsf(p.z());
+        if (dist + radius < 0) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // test four boxes at once, given as the lanes of their centres and half extents.
+    // returns a mask with bit i set if box i may be inside.
+    unsigned intersects4(const vec4 &cx, const vec4 &cy, const vec4 &cz, const vec4 &hx, const vec4 &hy, const vec4 &hz) const {
+      unsigned outside = 0;
+      for (int i = 0; i != num_planes; ++i) {
+        const vec4 &p = planes[i];
+        vec4 dist = cx * p.x() + cy * p.y() + cz * p.z() + vec4(p.w());
+        vec4 radius = hx * fabsf(p.x()) + hy * fabsf(p.y()) + hz * fabsf(p.z());
+        vec4 sum = dist + radius;
+        #ifdef OCTET_SSE
+          outside |= (unsigned)_mm_movemask_ps(_mm_cmplt_ps(sum.get_m(), _mm_setzero_ps()));
+        #else
+          for (int j = 0; j != 4; ++j) {
+            if (sum[j] < 0) outside |= 1 << j;
+          }
+        #endif
+      }
+      return ~outside & 15;
+    }
+
+    // test num_boxes boxes, four at a time. sets visible[i] to 1 if box i may be inside, else 0.
+    // returns the number of boxes that may be inside.
+    unsigned cull(const aabb *boxes, unsigned num_boxes, uint8_t *visible) const {
+      unsigned num_visible = 0;
+      for (unsigned i = 0; i < num_boxes; i += 4) {
+        unsigned n = min(num_boxes - i, 4u);
+
+        // transpose up to four boxes into lanes; repeat the last box to fill the batch
+        float c[3][4], h[3][4];
+        for (unsigned j = 0; j != 4; ++j) {
+          const aabb &bb = boxes[i + min(j, n - 1)];
+          vec3 center = bb.get_center();
+          vec3 half = bb.get_half_extent();
+          for (unsigned k = 0; k != 3; ++k) {
+            c[k][j] = center[k];
+            h[k][j] = half[k];
+          }
+        }
+
+        unsigned mask = intersects4(
+          vec4(c[0][0], c[0][1], c[0][2], c[0][3]),
+          vec4(c[1][0], c[1][1], c[1][2], c[1][3]),
+          vec4(c[2][0], c[2][1], c[2][2], c[2][3]),
+          vec4(h[0][0], h[0][1], h[0][2], h[0][3]),
+          vec4(h[1][0], h[1][1], h[1][2], h[1][3]),
+          vec4(h[2][0], h[2][1], h[2][2], h[2][3])
+        );
+
+        for (unsigned j = 0; j != n; ++j) {
+          uint8_t v = (uint8_t)((mask >> j) & 1);
+          visible[i + j] = v;
+          num_visible += v;
+        }
+      }
+      return num_visible;
+    }
+  };
+}
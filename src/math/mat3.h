@@ -0,0 +1,85 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// 3x3 matrix class
+//
+//
+
+// A plain 3x3 matrix of floats, mainly for mat3 uniforms such as normal matrices.
+// Like mat4t it is row major: row i is v[i*3+0..2] and the layout is the one
+// glUniformMatrix3fv expects with transpose = GL_FALSE.
+//
+namespace octet {
+  class mat3 {
+    float v[9];
+  public:
+    // default constructor: note does not initialize!
+    mat3() {}
+
+    mat3(float diag) {
+      v[0] = diag; v[1] = 0; v[2] = 0;
+      v[3] = 0; v[4] = diag; v[5] = 0;
+      v[6] = 0; v[7] = 0; v[8] = diag;
+    }
+
+    // the x, y and z rows of a mat4t without the w components
+    explicit mat3(const mat4t &r) {
+      for (int i = 0; i != 3; ++i) {
+        v[i*3+0] = r[i][0]; v[i*3+1] = r[i][1]; v[i*3+2] = r[i][2];
+      }
+    }
+
+    // general inverse of the 3x3 part of a mat4t.
+    // for a modelToWorld matrix (with v[i][3] == 0), this is the 3x3 part of inverse4x4().
+    static mat3 inverse3x3(const mat4t &r) {
+      const vec4 &a = r[0], &b = r[1], &c = r[2];
+      mat3 d;
+      d.v[0] = b[1]*c[2] - b[2]*c[1]; d.v[1] = a[2]*c[1] - a[1]*c[2]; d.v[2] = a[1]*b[2] - a[2]*b[1];
+      d.v[3] = b[2]*c[0] - b[0]*c[2]; d.v[4] = a[0]*c[2] - a[2]*c[0]; d.v[5] = a[2]*b[0] - a[0]*b[2];
+      d.v[6] = b[0]*c[1] - b[1]*c[0]; d.v[7] = a[1]*c[0] - a[0]*c[1]; d.v[8] = a[0]*b[1] - a[1]*b[0];
+      float rdet = 1.0f / (a[0]*d.v[0] + a[1]*d.v[3] + a[2]*d.v[6]);
+      for (int i = 0; i != 9; ++i) {
+        d.v[i] *= rdet;
+      }
+      return d;
+    }
+
+    mat3 transpose3x3() const {
+      mat3 d;
+      for (int i = 0; i != 3; ++i) {
+        d.v[i*3+0] = v[0*3+i]; d.v[i*3+1] = v[1*3+i]; d.v[i*3+2] = v[2*3+i];
+      }
+      return d;
+    }
+
+    // element accessor (row, column)
+    float &operator()(int row, int col) { return v[row*3+col]; }
+    const float &operator()(int row, int col) const { return v[row*3+col]; }
+
+    bool operator==(const mat3 &r) const {
+      for (int i = 0; i != 9; ++i) {
+        if (v[i] != r.v[i]) return false;
+      }
+      return true;
+    }
+
+    bool operator!=(const mat3 &r) const {
+      return !(*this == r);
+    }
+
+    // get a pointer to the nine floats, eg. for glUniformMatrix3fv
+    float *get() { return &v[0]; }
+    const float *get() const { return &v[0]; }
+
+    const char *toString(char *dest, size_t len) const {
+      snprintf(
+        dest, len, "[[%f, %f, %f], [%f, %f, %f], [%f, %f, %f]]",
+        v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8]
+      );
+      return dest;
+    }
+  };
+}
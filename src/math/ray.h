@@ -30,7 +30,7 @@ namespace octet {
     }
 
     ray get_transform(const mat4t &mat) const {
-      return ray((origin.xyz1() * mat).xyz(), (distance.xyz0() * mat).xyz());
+      return ray((origin.xyz1() * mat).xyz(), (get_end().xyz1() * mat).xyz());
     }
 
     const char *toString(char *dest, size_t len) const {
@@ -97,8 +97,9 @@ namespace octet {
       return origin + distance;
     }
 
+    // the vector from the start to the end
     vec3 get_distance() const {
-      return origin + distance;
+      return distance;
     }
   };
 
@@ -351,6 +351,10 @@ namespace octet {
       return v[3];
     }
 
+    #ifdef OCTET_SSE
+      __m128 get_m() const { return m; }
+    #endif
+
     // quaternion multiply
     vec4 qmul(const vec4 &r) const {
       return vec4(
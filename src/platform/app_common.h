@@ -22,6 +22,8 @@ namespace octet {
     attribute_blendindices = 7,
     attribute_texcoord = 8,
     attribute_uv = 8,
+    attribute_instance_matrix = 9, // a mat4 uses 9, 10, 11 and 12
+    attribute_instance_params = 13,
     attribute_tangent = 14,
     attribute_bitangent = 15,
     attribute_binormal = 15,
@@ -67,6 +69,189 @@ namespace octet {
     key_rmb,
   };
 
+  // times recorded for each frame by frame_timer, in seconds
+  enum frame_time {
+    // cpu time spent in each phase of the frame
+    frame_time_update,
+    frame_time_draw,
+    frame_time_swap,
+
+    // from the start of the frame to the end of the swap, for frames that were drawn
+    frame_time_total,
+
+    // from the start of the last frame to the start of this one, including any wait
+    frame_time_interval,
+
+    num_frame_times
+  };
+
+  /*
+   * frame_timer - measures the phases of each frame and keeps the last num_frames of them.
+   *
+   * The platform calls begin_frame before draw_world and end_frame after the swap.
+   * mark(phase, time) charges the time since the last mark to a phase, so an app that
+   * splits its update from its drawing marks frame_time_update when the update is done.
+   *
+   * In mode_fixed frames start every get_target_interval() seconds and get_timestep()
+   * is always that interval. In mode_unlimited the platform starts the next frame as soon
+   * as it can, which is what you want when benchmarking.
+   */
+  class frame_timer {
+  public:
+    enum { num_frames = 256 };
+
+    enum mode {
+      mode_fixed,
+      mode_unlimited
+    };
+
+  private:
+    float frames[num_frames][num_frame_times];
+    unsigned next_frame;
+    unsigned frame_count;
+
+    // frames not drawn since the start
+    unsigned skipped_frames;
+
+    float current[num_frame_times];
+    double frame_start;
+    double last_frame_start;
+    double last_mark;
+
+    mode mode_;
+    float target_interval;
+
+    static int compare_floats(const void *a, const void *b) {
+      float fa = *(const float*)a, fb = *(const float*)b;
+      return fa < fb ? -1 : fa > fb ? 1 : 0;
+    }
+
+  public:
+    frame_timer() {
+      next_frame = frame_count = 0;
+      skipped_frames = 0;
+      memset(current, 0, sizeof(current));
+      frame_start = last_frame_start = last_mark = 0;
+      mode_ = mode_fixed;
+      target_interval = 1.0f / 60;
+    }
+
+    void begin_frame(double time) {
+      memset(current, 0, sizeof(current));
+      last_frame_start = frame_start;
+      frame_start = last_mark = time;
+      current[frame_time_interval] = last_frame_start != 0 ? (float)(time - last_frame_start) : 0.0f;
+    }
+
+    // charge the time since the last mark to phase
+    void mark(frame_time phase, double time) {
+      current[phase] += (float)(time - last_mark);
+      last_mark = time;
+    }
+
+    // the app had nothing to draw. the frame still counts for pacing, but is not recorded.
+    void skip_frame() {
+      skipped_frames++;
+    }
+
+    // the time since the last mark is charged to the swap
+    void end_frame(double time) {
+      mark(frame_time_swap, time);
+      current[frame_time_total] = (float)(time - frame_start);
+      memcpy(frames[next_frame], current, sizeof(current));
+      next_frame = (next_frame + 1) % num_frames;
+      if (frame_count < num_frames) frame_count++;
+    }
+
+    mode get_mode() const {
+      return mode_;
+    }
+
+    void set_mode(mode new_mode) {
+      mode_ = new_mode;
+    }
+
+    float get_target_interval() const {
+      return target_interval;
+    }
+
+    void set_target_interval(float seconds) {
+      target_interval = seconds;
+    }
+
+    // how long the platform should wait at time before starting the next frame
+    double get_wait_time(double time) const {
+      if (mode_ == mode_unlimited || frame_start == 0) return 0;
+      double wait = frame_start + target_interval - time;
+      return wait > 0 ? wait : 0;
+    }
+
+    // seconds of animation to step this frame
+    float get_timestep() const {
+      if (mode_ == mode_fixed) return target_interval;
+      float interval = current[frame_time_interval];
+      return interval <= 0 ? target_interval : interval > 0.1f ? 0.1f : interval;
+    }
+
+    // number of frames recorded, up to num_frames
+    unsigned get_num_frames() const {
+      return frame_count;
+    }
+
+    unsigned get_num_skipped_frames() const {
+      return skipped_frames;
+    }
+
+    // the time below which percent% of the recorded frames fall
+    float get_percentile(frame_time which, float percent) const {
+      if (frame_count == 0) return 0;
+      float sorted[num_frames];
+      for (unsigned i = 0; i != frame_count; ++i) {
+        sorted[i] = frames[i][which];
+      }
+      qsort(sorted, frame_count, sizeof(float), compare_floats);
+      int index = (int)(percent * 0.01f * (frame_count - 1) + 0.5f);
+      return sorted[index < 0 ? 0 : index >= (int)frame_count ? frame_count - 1 : index];
+    }
+
+    float get_mean(frame_time which) const {
+      if (frame_count == 0) return 0;
+      float total = 0;
+      for (unsigned i = 0; i != frame_count; ++i) {
+        total += frames[i][which];
+      }
+      return total / frame_count;
+    }
+
+    // print the median, 95th and 99th percentiles of each time in ms
+    void print_stats() const {
+      static const char *names[num_frame_times] = { "update", "draw", "swap", "total", "interval" };
+      printf("Frame times over %d frames (%s, %d not drawn), ms: median / 95%% / 99%%\n", frame_count, mode_ == mode_fixed ? "fixed" : "unlimited", skipped_frames);
+      for (unsigned i = 0; i != num_frame_times; ++i) {
+        frame_time which = (frame_time)i;
+        printf(
+          "  %-8s %7.2f %7.2f %7.2f\n", names[i],
+          get_percentile(which, 50) * 1000, get_percentile(which, 95) * 1000, get_percentile(which, 99) * 1000
+        );
+      }
+    }
+  };
+
+  // reasons to draw a frame, see app_common::set_dirty
+  enum dirty_flags {
+    dirty_camera = 1 << 0,
+    dirty_parameters = 1 << 1,
+    dirty_animation = 1 << 2,
+    dirty_viewport = 1 << 3,
+    dirty_all = 0xffff
+  };
+
+  // a key or mouse button going down or up, recorded by the platform
+  struct input_event {
+    unsigned key;
+    bool is_down;
+  };
+
   class app_common {
     unsigned char keys[256];
     int mouse_x;
@@ -77,10 +262,17 @@ namespace octet {
     int frame_number;
     bool is_gles3;
     video_capture video_capture_;
+    frame_timer frame_timer_;
 
     // queue of files to load
     dynarray<string> load_queue;
 
+    // key changes since the last update_world
+    dynarray<input_event> input_events;
+
+    // dirty_flags set since the last frame was drawn
+    unsigned dirty;
+
   public:
     app_common() {
       // this memset writes 0 to every byte of keys[]
@@ -88,6 +280,8 @@ namespace octet {
       mouse_x = mouse_y = 0;
       is_gles3 = false;
       frame_number = 0;
+      viewport_x = viewport_y = 0;
+      dirty = dirty_all;
     }
 
     virtual ~app_common() {
@@ -96,11 +290,56 @@ namespace octet {
     virtual void draw_world(int x, int y, int w, int h) = 0;
     virtual void app_init() = 0;
 
+    // called by the platform once a frame before draw_world, with the input events since the
+    // last call. timestep is the time to animate by (see frame_timer::get_timestep).
+    // the frame is drawn if this returns true or if anything is dirty (see set_dirty), so
+    // apps that track their changes return false.
+    virtual bool update_world(float timestep) {
+      return true;
+    }
+
+    // something has changed that needs the frame to be drawn again. flags are dirty_flags.
+    void set_dirty(unsigned flags = dirty_all) {
+      dirty |= flags;
+    }
+
+    // the dirty_flags set since the last frame was drawn
+    unsigned get_dirty() {
+      return dirty;
+    }
+
+    // used by the platform once the frame is drawn
+    void clear_dirty() {
+      dirty = 0;
+    }
+
     // returns true if a key is down
     bool is_key_down(unsigned key) {
       return keys[key & 0xff] == 1;
     }
 
+    // returns true if a key went down since the last update_world
+    bool is_key_going_down(unsigned key) {
+      for (unsigned i = 0; i != input_events.size(); ++i) {
+        if (input_events[i].key == (key & 0xff) && input_events[i].is_down) return true;
+      }
+      return false;
+    }
+
+    // key changes in the order they happened, oldest first
+    unsigned get_num_input_events() {
+      return input_events.size();
+    }
+
+    const input_event &get_input_event(unsigned i) {
+      return input_events[i];
+    }
+
+    // used by the platform after update_world
+    void clear_input_events() {
+      input_events.resize(0);
+    }
+
     void get_mouse_pos(int &x, int &y) {
       x = mouse_x;
       y = mouse_y;
@@ -131,8 +370,17 @@ namespace octet {
       return &video_capture_;
     }
 
+    frame_timer &get_frame_timer() {
+      return frame_timer_;
+    }
+
     // used by the platform to set a key
+    // only changes are queued, so auto-repeat does not make more events
     void set_key(unsigned key, bool is_down) {
+      if ((keys[key & 0xff] == 1) != is_down) {
+        input_event event = { key & 0xff, is_down };
+        input_events.push_back(event);
+      }
       keys[key & 0xff] = is_down ? 1 : 0;
     }
 
@@ -150,6 +398,9 @@ namespace octet {
     void set_viewport_size(int x, int y) {
       // make the viewport size even, so the centre is always
       // at the centre of a pixel.
+      if ((x & ~1) != viewport_x || (y & ~1) != viewport_y) {
+        dirty |= dirty_viewport;
+      }
       viewport_x = x & ~1; // ie, clear the bottom bit.
       viewport_y = y & ~1;
       //printf("set_viewport_size: %03x %03x\n", viewport_x, viewport_y);
@@ -109,8 +109,20 @@ namespace octet {
       //printf("render %d\n", glutGetWindow());
       int vx, vy;
       get_viewport_size(vx, vy);
+      frame_timer &timer = get_frame_timer();
+      timer.begin_frame(get_time());
+      bool draw = update_world(timer.get_timestep()) || get_dirty() != 0;
+      clear_input_events();
+      timer.mark(frame_time_update, get_time());
+      if (!draw) {
+        timer.skip_frame();
+        return;
+      }
       draw_world(0, 0, vx, vy);
       inc_frame_number();
+      clear_dirty();
+      timer.mark(frame_time_draw, get_time());
+      timer.end_frame(get_time());
     }
 
     ~app() {
@@ -130,6 +142,17 @@ namespace octet {
       printf("%s - exiting\n", msg);
       exit(1);
     }
+
+    // wall clock time in seconds, monotonic where the C library has it
+    static double get_time() {
+      timespec now;
+      #if defined(CLOCK_MONOTONIC)
+        clock_gettime(CLOCK_MONOTONIC, &now);
+      #else
+        timespec_get(&now, TIME_UTC);
+      #endif
+      return now.tv_sec + now.tv_nsec * 1e-9;
+    }
   };
 
 }
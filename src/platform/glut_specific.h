@@ -33,6 +33,7 @@
   #include <OpenAL/al.h>
   #include <OpenCL/cl.h>
   #include <GLUT/glut.h>
+  #include <mach/mach_time.h>
   #if OCTET_OPENCL
     #include <OpenCL/opencl.h>
   #endif
@@ -46,6 +47,12 @@ namespace octet {
   class app : public app_common {
     int window_handle;
 
+    // true while a timer is waiting to start the next frame
+    bool frame_pending;
+
+    // true when the timer has started a frame; other redisplays (eg. exposes) only redraw
+    bool frame_due;
+
     typedef hash_map<int, app*> map_t;
 
     static map_t &map() {
@@ -56,6 +63,9 @@ namespace octet {
   public:
     // constructor
     app(int argc, char **argv) {
+      window_handle = 0;
+      frame_pending = false;
+      frame_due = false;
     }
 
     // initialiser (it is nice to keep the two separate for aggregate memory allocation)
@@ -72,11 +82,36 @@ namespace octet {
 
     void render() {
       //printf("render %d\n", glutGetWindow());
-      int vx, vy;
-      get_viewport_size(vx, vy);
-      draw_world(0, 0, vx, vy);
-      inc_frame_number();
-      glutSwapBuffers();
+      frame_timer &timer = get_frame_timer();
+      timer.begin_frame(get_time());
+
+      bool draw = true;
+      if (frame_due) {
+        frame_due = false;
+        draw = update_world(timer.get_timestep()) || get_dirty() != 0;
+        clear_input_events();
+        timer.mark(frame_time_update, get_time());
+      }
+
+      if (draw) {
+        int vx, vy;
+        get_viewport_size(vx, vy);
+        draw_world(0, 0, vx, vy);
+        inc_frame_number();
+        clear_dirty();
+        timer.mark(frame_time_draw, get_time());
+
+        glutSwapBuffers();
+        timer.end_frame(get_time());
+      } else {
+        timer.skip_frame();
+      }
+
+      // redisplays from reshapes and exposes do not start another chain of frames
+      if (!frame_pending) {
+        frame_pending = true;
+        glutTimerFunc((unsigned)(timer.get_wait_time(get_time()) * 1000), next_frame, window_handle);
+      }
     }
 
     static unsigned translate_special(unsigned key) {
@@ -131,14 +166,14 @@ namespace octet {
       map()[glutGetWindow()]->set_mouse_pos(x, y);
     }
 
-    static void timer(int value) {
-      glutTimerFunc(16, timer, 1);
-      map_t &m = map();
-      for (int i = 0; i != m.size(); ++i) {
-        if (m.key(i)) {
-          glutSetWindow(m.key(i));
-          glutPostRedisplay();
-        }
+    // start the next frame of one window. value is the window handle.
+    static void next_frame(int value) {
+      app *the_app = map()[value];
+      if (the_app) {
+        the_app->frame_pending = false;
+        the_app->frame_due = true;
+        glutSetWindow(value);
+        glutPostRedisplay();
       }
     }
   
@@ -171,9 +206,10 @@ namespace octet {
           glutMouseFunc(do_mouse_button);
           glutMotionFunc(do_mouse);
           glutPassiveMotionFunc(do_mouse);
+          m.value(i)->frame_pending = true;
+          glutTimerFunc(0, next_frame, m.key(i));
         }
       }
-      glutTimerFunc(16, timer, 1);
       glutMainLoop();
     }
 
@@ -181,6 +217,26 @@ namespace octet {
       printf("%s - exiting\n", msg);
       exit(1);
     }
+
+    // monotonic wall clock time in seconds.
+    // GLUT_ELAPSED_TIME is only in whole milliseconds, too coarse to time the phases of a frame.
+    static double get_time() {
+      #if defined(WIN32)
+        static LARGE_INTEGER frequency;
+        if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+        return (double)counter.QuadPart / (double)frequency.QuadPart;
+      #elif defined(__APPLE__)
+        static mach_timebase_info_data_t timebase;
+        if (!timebase.denom) mach_timebase_info(&timebase);
+        return (double)mach_absolute_time() * timebase.numer / timebase.denom * 1e-9;
+      #else
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec + now.tv_nsec * 1e-9;
+      #endif
+    }
   };
 
   // dummy video capture class
@@ -35,6 +35,7 @@
 #include <stdint.h>
 #include <stdarg.h>
 #include <math.h>
+#include <time.h>
 #include <assert.h>
 
 // xml library
@@ -110,10 +111,12 @@ static char *get_sprintf_buffer() {
 #include "../math/ivec4.h"
 #include "../math/quat.h"
 #include "../math/mat4t.h"
+#include "../math/mat3.h"
 #include "../math/bvec2.h"
 #include "../math/bvec3.h"
 #include "../math/bvec4.h"
 #include "../math/aabb.h"
+#include "../math/frustum.h"
 #include "../math/ray.h"
 #include "../math/random.h"
 
@@ -150,11 +153,17 @@ static char *get_sprintf_buffer() {
 #include "../resources/gl_resource.h"
 #include "../resources/bitmap_font.h"
 #include "../resources/mesh_builder.h"
+#include "../resources/thread_pool.h"
+#include "../resources/mapped_file.h"
+#include "../resources/cubemap_cache.h"
+#include "../resources/cubemap_prefilter.h"
+#include "../resources/cubemap_image.h"
 
 // shaders
 #include "../shaders/shader.h"
 #include "../shaders/color_shader.h"
 #include "../shaders/cubemap_shader.h"
+#include "../shaders/diffraction_reference.h"
 #include "../shaders/texture_shader.h"
 #include "../shaders/phong_shader.h"
 #include "../shaders/bump_shader.h"
@@ -166,6 +175,7 @@ static char *get_sprintf_buffer() {
 #include "../scene/skin.h"
 #include "../scene/skeleton.h"
 #include "../scene/animation.h"
+#include "../scene/bvh.h"
 #include "../scene/mesh.h"
 #include "../scene/image.h"
 #include "../scene/sampler.h"
@@ -174,7 +184,10 @@ static char *get_sprintf_buffer() {
 #include "../scene/camera_instance.h"
 #include "../scene/light_instance.h"
 #include "../scene/mesh_instance.h"
+#include "../scene/instanced_mesh.h"
+#include "../scene/lod_mesh.h"
 #include "../scene/animation_instance.h"
+#include "../scene/render_queue.h"
 #include "../scene/scene.h"
 #include "../scene/displacement_map.h"
 #include "../scene/indexer.h"
@@ -188,6 +201,7 @@ static char *get_sprintf_buffer() {
 // high level helpers
 #include "../helpers/mouse_ball.h"
 #include "../helpers/http_server.h"
+#include "../helpers/ui_layer.h"
 #include "../helpers/text_overlay.h"
 #include "../helpers/object_picker.h"
 
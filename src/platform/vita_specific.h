@@ -19,6 +19,7 @@
 #include "app_common.h"
 
 #include <net.h>
+#include <kernel.h>
 #define FIONBIO 1
 
 inline void ioctlsocket(int socket, unsigned kind, unsigned long *up) {
@@ -70,12 +71,24 @@ namespace octet {
     }
 
     void render() {
+      frame_timer &timer = get_frame_timer();
+      timer.begin_frame(get_time());
+
+      bool draw = update_world(timer.get_timestep()) || get_dirty() != 0;
+      clear_input_events();
+      timer.mark(frame_time_update, get_time());
+      if (!draw) {
+        timer.skip_frame();
+        return;
+      }
 
       draw_world(0, 0, 1024, 768);
       inc_frame_number();
+      clear_dirty();
+      timer.mark(frame_time_draw, get_time());
 
       //SwapBuffers(hdc);
-
+      timer.end_frame(get_time());
     }
 
     /*static unsigned translate(unsigned key) {
@@ -142,5 +155,9 @@ namespace octet {
 
     static bool &sound_disabled() { static bool instance; return instance; }
 
+    // wall clock time in seconds
+    static double get_time() {
+      return sceKernelGetProcessTimeWide() * 0.000001;
+    }
   };
 }
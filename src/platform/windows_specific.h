@@ -178,10 +178,24 @@ namespace octet {
       GetClientRect(window_handle, &rect);
       set_viewport_size(rect.right - rect.left, rect.bottom - rect.top);
 
-      draw_world(rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top);
-      inc_frame_number();
+      frame_timer &timer = get_frame_timer();
+      timer.begin_frame(get_time());
 
-      SwapBuffers(hdc);
+      bool draw = update_world(timer.get_timestep()) || get_dirty() != 0;
+      clear_input_events();
+      timer.mark(frame_time_update, get_time());
+
+      if (draw) {
+        draw_world(rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top);
+        inc_frame_number();
+        clear_dirty();
+        timer.mark(frame_time_draw, get_time());
+
+        SwapBuffers(hdc);
+        timer.end_frame(get_time());
+      } else {
+        timer.skip_frame();
+      }
 
       wglMakeCurrent (hdc, NULL);
       ReleaseDC(window_handle, hdc);
@@ -283,8 +297,15 @@ namespace octet {
           DispatchMessage (&msg);
         }
 
-        // waste some time. (do not do this in real games!)
-        Sleep(1000/30);
+        // wait until the next frame is due (no wait for frame_timer::mode_unlimited)
+        double wait = 1.0;
+        for (int i = 0; i != m.size(); ++i) {
+          if (m.key(i) && m.value(i)) {
+            double app_wait = m.value(i)->get_frame_timer().get_wait_time(get_time());
+            if (app_wait < wait) wait = app_wait;
+          }
+        }
+        if (wait > 0.001) Sleep((DWORD)(wait * 1000));
 
         for (int i = 0; i != m.size(); ++i) {
           // note: because Win8 generates an invisible window, we need to check m.value(i)
@@ -302,6 +323,14 @@ namespace octet {
 
     static bool &sound_disabled() { static bool instance; return instance; }
 
+    // wall clock time in seconds
+    static double get_time() {
+      static LARGE_INTEGER frequency;
+      if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+      LARGE_INTEGER counter;
+      QueryPerformanceCounter(&counter);
+      return (double)counter.QuadPart / (double)frequency.QuadPart;
+    }
   };
 
   //////////////////////////////////////
@@ -49,12 +49,14 @@ namespace octet {
     }
   
     // turn a url into a file path
-    static const char *get_path(const char *url) {
-      if (url == NULL) return "";
+    static void get_path(string &path, const char *url) {
+      if (url == NULL) {
+        path = "";
+        return;
+      }
 
       string url_str;
       url_str.urldecode(url);
-      static string path;
 
       if (url[0] == '/' || (url[0] >= 'A' && url[0] <= 'Z' && url[1] == ':')) {
         path = url_str;
@@ -62,6 +64,12 @@ namespace octet {
         // relative path
         path.format("%s%s", prefix(), url_str.c_str());
       }
+    }
+
+    // turn a url into a file path. the result is only valid until the next call.
+    static const char *get_path(const char *url) {
+      static string path;
+      get_path(path, url);
       return path;
     }
 
@@ -80,9 +88,12 @@ namespace octet {
       } else if (!strncmp(url, "http://", 7)) {
         // http
       } else {
-        FILE *file = fopen(get_path(url), "rb");
+        // a local path, so that files can be read from several threads
+        string path;
+        get_path(path, url);
+        FILE *file = fopen(path, "rb");
         if (!file) {
-          printf("file %s not found\n", get_path(url));
+          printf("file %s not found\n", path.c_str());
         } else {
           fseek(file, 0, SEEK_END);
           buffer.resize((unsigned)ftell(file));
@@ -177,23 +188,42 @@ namespace octet {
     static GLuint make_cubemap_texture(unsigned gl_kind,
       unsigned size, unsigned in_format, unsigned width, unsigned height,
       uint8_t *posx, uint8_t *posy, uint8_t *posz, uint8_t *negx, uint8_t *negy, uint8_t *negz) {
+      const uint8_t *faces[6] = { posx, posy, posz, negx, negy, negz };
+      return make_cubemap_texture(gl_kind, in_format, width, height, 1, faces);
+    }
+
+    // make a cube map from a mip chain built elsewhere. faces has six pointers for each level
+    // (posx, posy, posz, negx, negy, negz), level 0 first; each level is half the size of the last.
+    // with only one level, the mip maps are generated by GL.
+    static GLuint make_cubemap_texture(unsigned gl_kind, unsigned in_format, unsigned width, unsigned height, unsigned num_levels, const uint8_t *const *faces) {
+      static const GLenum targets[6] = {
+        GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
+        GL_TEXTURE_CUBE_MAP_NEGATIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
+      };
+
       GLuint handle = 0;
       glGenTextures(1, &handle);
+      glBindTexture(GL_TEXTURE_CUBE_MAP, handle);
 
       glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
       glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
       glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-      glBindTexture(GL_TEXTURE_CUBE_MAP, handle);
-
-      glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, gl_kind, width, height, 0, in_format, GL_UNSIGNED_BYTE, (void*)posx);
-      glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, gl_kind, width, height, 0, in_format, GL_UNSIGNED_BYTE, (void*)posy);
-      glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, gl_kind, width, height, 0, in_format, GL_UNSIGNED_BYTE, (void*)posz);
-      glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, gl_kind, width, height, 0, in_format, GL_UNSIGNED_BYTE, (void*)negx);
-      glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, gl_kind, width, height, 0, in_format, GL_UNSIGNED_BYTE, (void*)negy);
-      glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, gl_kind, width, height, 0, in_format, GL_UNSIGNED_BYTE, (void*)negz);
+      // small RGB levels have rows that are not a multiple of four bytes
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      for (unsigned level = 0; level != num_levels; ++level) {
+        unsigned w = width >> level, h = height >> level;
+        w = w ? w : 1;
+        h = h ? h : 1;
+        for (unsigned face = 0; face != 6; ++face) {
+          glTexImage2D(targets[face], level, gl_kind, w, h, 0, in_format, GL_UNSIGNED_BYTE, (void*)faces[level * 6 + face]);
+        }
+      }
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-      glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+      if (num_levels == 1) {
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+      }
       glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
       return handle;
     }
@@ -0,0 +1,215 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// decoded cube maps saved as one binary file
+//
+
+namespace octet {
+  /*
+   * cubemap_cache - a cube map and its mip chain, decoded and saved next to the source images.
+   *
+   * The file is a header followed by the pixels of each level, level 0 first, six faces
+   * per level in the order posx, posy, posz, negx, negy, negz, with tightly packed rows.
+   * The key is a hash of the source files, so editing an image rebuilds the cache.
+   *
+   * Loading maps the file and passes the pixels straight to GL, so there is no decode
+   * and no copy on the CPU.
+   */
+  class cubemap_cache {
+    enum {
+      // 2: the levels are prefiltered (cubemap_prefilter) instead of box filtered
+      version = 2,
+
+      // enough for any 32 bit width and height
+      max_levels = 32
+    };
+
+    struct header {
+      char magic[4];
+      uint32_t version;
+      uint32_t key_lo;
+      uint32_t key_hi;
+      uint32_t format;
+      uint32_t width;
+      uint32_t height;
+      uint32_t num_levels;
+    };
+
+    static unsigned get_bytes_per_pixel(unsigned format) {
+      return format == GL_RGB ? 3 : 4;
+    }
+
+    // size in bytes of one face of one level
+    static unsigned get_face_size(unsigned format, unsigned width, unsigned height, unsigned level) {
+      unsigned w = width >> level, h = height >> level;
+      return (w ? w : 1) * (h ? h : 1) * get_bytes_per_pixel(format);
+    }
+
+    // halve one face with a 2x2 box filter
+    static void downsample(uint8_t *dest, const uint8_t *src, unsigned src_w, unsigned src_h, unsigned bpp) {
+      unsigned w = src_w > 1 ? src_w / 2 : 1, h = src_h > 1 ? src_h / 2 : 1;
+      for (unsigned y = 0; y != h; ++y) {
+        unsigned y0 = y * 2, y1 = min(y0 + 1, src_h - 1);
+        for (unsigned x = 0; x != w; ++x) {
+          unsigned x0 = x * 2, x1 = min(x0 + 1, src_w - 1);
+          const uint8_t *p00 = src + (y0 * src_w + x0) * bpp, *p01 = src + (y0 * src_w + x1) * bpp;
+          const uint8_t *p10 = src + (y1 * src_w + x0) * bpp, *p11 = src + (y1 * src_w + x1) * bpp;
+          for (unsigned c = 0; c != bpp; ++c) {
+            *dest++ = (uint8_t)((p00[c] + p01[c] + p10[c] + p11[c] + 2) >> 2);
+          }
+        }
+      }
+    }
+
+  public:
+    // number of levels down to 1x1
+    static unsigned get_num_levels(unsigned width, unsigned height) {
+      unsigned num_levels = 1;
+      while ((width >> num_levels) || (height >> num_levels)) {
+        ++num_levels;
+      }
+      return num_levels;
+    }
+
+    // 64 bit FNV-1a of the source files' lengths and contents
+    static uint64_t get_key(const resources::decoded_image *faces, unsigned num_faces) {
+      uint64_t key = 0xcbf29ce484222325ull;
+      for (unsigned i = 0; i != num_faces; ++i) {
+        unsigned size = faces[i].file.size();
+        for (unsigned j = 0; j != 4; ++j) {
+          key = (key ^ ((size >> (j * 8)) & 0xff)) * 0x100000001b3ull;
+        }
+        const uint8_t *src = faces[i].file.data();
+        for (unsigned j = 0; j != size; ++j) {
+          key = (key ^ src[j]) * 0x100000001b3ull;
+        }
+      }
+      return key;
+    }
+
+    // the cache lives next to the first face, eg. assets/cubemaps/Tenerife4/Tenerife4.cubecache
+    // there is nowhere to write inside a zip file, so those are not cached.
+    static bool get_path(string &path, const char *posx_url, const char *name) {
+      if (!strncmp(posx_url, "zip://", 6) || !strncmp(posx_url, "http://", 7)) {
+        return false;
+      }
+      app_utils::get_path(path, posx_url);
+      path.truncate(path.filename_pos());
+      string filename;
+      filename.format("%s.cubecache", name);
+      path += filename.c_str();
+      return true;
+    }
+
+    // build a box filtered mip chain for six decoded faces of the same size and format, in the file order.
+    static void build_mip_chain(dynarray<uint8_t> &chain, unsigned &num_levels, const resources::decoded_image *faces) {
+      unsigned format = faces[0].format, width = faces[0].width, height = faces[0].height;
+      unsigned bpp = get_bytes_per_pixel(format);
+      num_levels = get_num_levels(width, height);
+
+      unsigned total = 0;
+      for (unsigned level = 0; level != num_levels; ++level) {
+        total += get_face_size(format, width, height, level) * 6;
+      }
+      chain.resize(total);
+
+      uint8_t *dest = chain.data();
+      unsigned face_size = get_face_size(format, width, height, 0);
+      for (unsigned face = 0; face != 6; ++face) {
+        memcpy(dest, faces[face].pixels.data(), face_size);
+        dest += face_size;
+      }
+
+      const uint8_t *src = chain.data();
+      for (unsigned level = 1; level != num_levels; ++level) {
+        unsigned src_w = max(width >> (level - 1), 1u), src_h = max(height >> (level - 1), 1u);
+        unsigned src_size = get_face_size(format, width, height, level - 1);
+        for (unsigned face = 0; face != 6; ++face) {
+          downsample(dest, src, src_w, src_h, bpp);
+          src += src_size;
+          dest += get_face_size(format, width, height, level);
+        }
+      }
+    }
+
+    // write a mip chain built by build_mip_chain (or anything laid out the same way)
+    static bool save(const char *path, uint64_t key, unsigned format, unsigned width, unsigned height, unsigned num_levels, const dynarray<uint8_t> &chain) {
+      FILE *file = fopen(path, "wb");
+      if (!file) {
+        printf("warning: could not write cube map cache %s\n", path);
+        return false;
+      }
+
+      header hdr;
+      memcpy(hdr.magic, "OCMC", 4);
+      hdr.version = version;
+      hdr.key_lo = (uint32_t)key;
+      hdr.key_hi = (uint32_t)(key >> 32);
+      hdr.format = format;
+      hdr.width = width;
+      hdr.height = height;
+      hdr.num_levels = num_levels;
+
+      bool ok = fwrite(&hdr, sizeof(hdr), 1, file) == 1 && fwrite(chain.data(), 1, chain.size(), file) == chain.size();
+      fclose(file);
+      if (!ok) {
+        remove(path);
+        printf("warning: could not write cube map cache %s\n", path);
+      }
+      return ok;
+    }
+
+    // six pointers per level into a chain laid out like build_mip_chain. false if src_max comes first.
+    static bool get_level_faces(const uint8_t **faces, const uint8_t *src, const uint8_t *src_max, unsigned format, unsigned width, unsigned height, unsigned num_levels) {
+      for (unsigned level = 0; level != num_levels; ++level) {
+        unsigned face_size = get_face_size(format, width, height, level);
+        for (unsigned face = 0; face != 6; ++face) {
+          if (src + face_size > src_max) {
+            return false;
+          }
+          faces[level * 6 + face] = src;
+          src += face_size;
+        }
+      }
+      return true;
+    }
+
+    // map the cache and make a texture from it. returns 0 if the file is missing, stale or damaged.
+    static GLuint load_texture(unsigned gl_kind, const char *path, uint64_t key) {
+      mapped_file file;
+      if (!file.open(path) || file.size() < sizeof(header)) {
+        return 0;
+      }
+
+      header hdr;
+      memcpy(&hdr, file.data(), sizeof(hdr));
+      if (
+        memcmp(hdr.magic, "OCMC", 4) || hdr.version != version ||
+        hdr.key_lo != (uint32_t)key || hdr.key_hi != (uint32_t)(key >> 32) ||
+        hdr.num_levels == 0 || hdr.num_levels > get_num_levels(hdr.width, hdr.height)
+      ) {
+        return 0;
+      }
+
+      // six pointers per level into the mapped file
+      const uint8_t *faces[max_levels * 6];
+      if (!get_level_faces(faces, file.data() + sizeof(header), file.data() + file.size(), hdr.format, hdr.width, hdr.height, hdr.num_levels)) {
+        return 0;
+      }
+
+      return app_utils::make_cubemap_texture(gl_kind, hdr.format, hdr.width, hdr.height, hdr.num_levels, faces);
+    }
+
+    // make a texture straight from a mip chain, for when the cache can not be written or read back
+    static GLuint make_texture(unsigned gl_kind, unsigned format, unsigned width, unsigned height, unsigned num_levels, const dynarray<uint8_t> &chain) {
+      const uint8_t *faces[max_levels * 6];
+      if (num_levels == 0 || num_levels > max_levels || !get_level_faces(faces, chain.data(), chain.data() + chain.size(), format, width, height, num_levels)) {
+        return 0;
+      }
+      return app_utils::make_cubemap_texture(gl_kind, format, width, height, num_levels, faces);
+    }
+  };
+}
@@ -0,0 +1,139 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// cube map kept in memory for sampling on the CPU
+//
+
+namespace octet {
+  /*
+   * cubemap_image - the six faces of a cube map and their prefiltered mip chain as decoded bytes.
+   *
+   * sample() follows the GL face selection rules and filters bilinearly, so it matches
+   * textureCube() on the base level closely enough for offline rendering. sample() with a
+   * level of detail blends the two nearest levels of the chain built by cubemap_prefilter,
+   * as textureCube() does with the texture made by resources::get_cubemap_texture_handle.
+   * Once loaded, sampling does not write anything and can be done from several threads.
+   */
+  class cubemap_image {
+  public:
+    enum {
+      num_faces = 6,
+      max_levels = 32
+    };
+
+  private:
+    // all the levels, level 0 first, six faces per level in the order posx, posy, posz, negx, negy, negz
+    dynarray<uint8_t> chain;
+    unsigned level_offsets[max_levels];
+    unsigned num_levels;
+    uint16_t format;
+    uint16_t width;
+    uint16_t height;
+    unsigned bytes_per_pixel;
+
+    unsigned get_level_width(unsigned level) const {
+      return max((unsigned)width >> level, 1u);
+    }
+
+    unsigned get_level_height(unsigned level) const {
+      return max((unsigned)height >> level, 1u);
+    }
+
+    vec4 texel(unsigned level, unsigned f, int x, int y) const {
+      int w = (int)get_level_width(level), h = (int)get_level_height(level);
+      x = x < 0 ? 0 : x >= w ? w - 1 : x;
+      y = y < 0 ? 0 : y >= h ? h - 1 : y;
+      const uint8_t *p = &chain[level_offsets[level] + ((f * h + y) * w + x) * bytes_per_pixel];
+      float a = bytes_per_pixel == 4 ? p[3] : 255.0f;
+      return vec4(p[0], p[1], p[2], a) * (1.0f / 255);
+    }
+
+    vec4 sample_level(unsigned level, unsigned f, float s, float t) const {
+      float x = s * get_level_width(level) - 0.5f;
+      float y = t * get_level_height(level) - 0.5f;
+      int x0 = (int)floorf(x), y0 = (int)floorf(y);
+      float fx = x - x0, fy = y - y0;
+      vec4 top = texel(level, f, x0, y0) * (1 - fx) + texel(level, f, x0 + 1, y0) * fx;
+      vec4 bottom = texel(level, f, x0, y0 + 1) * (1 - fx) + texel(level, f, x0 + 1, y0 + 1) * fx;
+      return top * (1 - fy) + bottom * fy;
+    }
+
+  public:
+    cubemap_image() {
+      format = width = height = 0;
+      bytes_per_pixel = 0;
+      num_levels = 0;
+    }
+
+    // load the six faces in parallel and prefilter the mip chain. all the faces must have the same size and format.
+    bool load(const char *posx_url, const char *posy_url, const char *posz_url, const char *negx_url, const char *negy_url, const char *negz_url) {
+      const char *urls[num_faces] = { posx_url, posy_url, posz_url, negx_url, negy_url, negz_url };
+      resources::decoded_image images[num_faces];
+      if (!resources::get_images(images, urls, num_faces)) {
+        return false;
+      }
+      for (unsigned f = 0; f != num_faces; ++f) {
+        if (images[f].format != images[0].format || images[f].width != images[0].width || images[f].height != images[0].height) {
+          printf("warning: cube map face %s does not match the others\n", urls[f]);
+          return false;
+        }
+      }
+      cubemap_prefilter::build_mip_chain(chain, num_levels, images);
+      format = images[0].format;
+      width = images[0].width;
+      height = images[0].height;
+      bytes_per_pixel = format == GL_RGB ? 3 : 4;
+
+      unsigned offset = 0;
+      for (unsigned level = 0; level != num_levels; ++level) {
+        level_offsets[level] = offset;
+        offset += get_level_width(level) * get_level_height(level) * bytes_per_pixel * num_faces;
+      }
+      return true;
+    }
+
+    bool is_loaded() const {
+      return width != 0;
+    }
+
+    uint16_t get_width() const {
+      return width;
+    }
+
+    uint16_t get_height() const {
+      return height;
+    }
+
+    unsigned get_num_levels() const {
+      return num_levels;
+    }
+
+    // bilinear sample of level 0 in the direction dir (need not be normalized). colours are in [0, 1].
+    vec4 sample(const vec3 &dir) const {
+      if (!width) return vec4(0, 0, 0, 1);
+      float s, t;
+      unsigned f = cubemap_prefilter::get_face(dir, s, t);
+      return sample_level(0, f, s, t);
+    }
+
+    // trilinear sample at level of detail lod, clamped to the chain.
+    // the reflection shaders use lod = max(log2(cubemap_prefilter::get_lod_scale() / r), 0).
+    vec4 sample(const vec3 &dir, float lod) const {
+      if (!width) return vec4(0, 0, 0, 1);
+      float s, t;
+      unsigned f = cubemap_prefilter::get_face(dir, s, t);
+      float max_lod = (float)(num_levels - 1);
+      lod = lod < 0 ? 0 : lod > max_lod ? max_lod : lod;
+      unsigned level = (unsigned)lod;
+      float frac = lod - level;
+      vec4 result = sample_level(level, f, s, t);
+      if (frac != 0) {
+        result = result * (1 - frac) + sample_level(level + 1, f, s, t) * frac;
+      }
+      return result;
+    }
+  };
+}
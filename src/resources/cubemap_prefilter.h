@@ -0,0 +1,244 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// cube map mip chains blurred for rough reflections
+//
+
+namespace octet {
+  /*
+   * cubemap_prefilter - builds a cube map mip chain where each level is the reflection
+   * of a rougher surface, instead of a plain box filtered copy of the level above.
+   *
+   * Level l is the base image convolved with a gaussian lobe of angular width
+   * get_sigma(l) = 2^l / get_lod_scale() radians, which doubles every level like the texel size.
+   * The width does not depend on the size of the map, so a shader that treats 1 / r as
+   * the width of its reflection lobe picks the level with
+   *
+   *   lod = max(log2(get_lod_scale() / r), 0.0)
+   *
+   * The chain has the same layout as cubemap_cache::build_mip_chain, so it can be saved
+   * in the cache. Rows are filtered on the thread_pool.
+   */
+  class cubemap_prefilter {
+    enum {
+      // taps each side of the centre: the kernel covers +/- 2 sigma in steps of sigma / 2
+      kernel_radius = 4,
+      kernel_width = kernel_radius * 2 + 1,
+      max_taps = kernel_width * kernel_width
+    };
+
+    // offset of one tap in the tangent frame, scaled so that n * z + t * x + b * y is on the sphere
+    struct tap {
+      float x, y, z;
+      float weight;
+    };
+
+    // one level being filtered. faces are in the order posx, posy, posz, negx, negy, negz.
+    struct context {
+      const uint8_t *src[6];
+      unsigned src_size;
+      uint8_t *dest[6];
+      unsigned dest_size;
+      unsigned bpp;
+      float sigma;
+      tap taps[max_taps];
+      unsigned num_taps;
+      float rtotal_weight;
+    };
+
+    // direction through (sc, tc) in [-1, 1] on a face. the inverse of get_face.
+    static void get_dir(float *dir, unsigned face, float sc, float tc) {
+      switch (face) {
+        case 0: dir[0] = 1; dir[1] = -tc; dir[2] = -sc; break;
+        case 1: dir[0] = sc; dir[1] = 1; dir[2] = tc; break;
+        case 2: dir[0] = sc; dir[1] = -tc; dir[2] = 1; break;
+        case 3: dir[0] = -1; dir[1] = -tc; dir[2] = sc; break;
+        case 4: dir[0] = sc; dir[1] = -1; dir[2] = -tc; break;
+        default: dir[0] = -sc; dir[1] = -tc; dir[2] = -1; break;
+      }
+    }
+
+    // bilinear sample of the source level, clamped to the edges of each face
+    static void sample(float *result, const context &c, const float *dir) {
+      float s, t;
+      unsigned face = get_face(vec3(dir[0], dir[1], dir[2]), s, t);
+      int size = (int)c.src_size;
+      float x = s * size - 0.5f, y = t * size - 0.5f;
+      int x0 = (int)floorf(x), y0 = (int)floorf(y);
+      float fx = x - x0, fy = y - y0;
+      int x1 = min(x0 + 1, size - 1), y1 = min(y0 + 1, size - 1);
+      x0 = max(x0, 0); y0 = max(y0, 0);
+      const uint8_t *src = c.src[face];
+      unsigned bpp = c.bpp;
+      const uint8_t *p00 = src + (y0 * size + x0) * bpp, *p01 = src + (y0 * size + x1) * bpp;
+      const uint8_t *p10 = src + (y1 * size + x0) * bpp, *p11 = src + (y1 * size + x1) * bpp;
+      for (unsigned i = 0; i != bpp; ++i) {
+        float top = p00[i] + (p01[i] - p00[i]) * fx;
+        float bottom = p10[i] + (p11[i] - p10[i]) * fx;
+        result[i] = top + (bottom - top) * fy;
+      }
+    }
+
+    // filter one row of one face of the destination level
+    static void filter_row(void *context_ptr, unsigned index) {
+      const context &c = *(const context*)context_ptr;
+      unsigned face = index / c.dest_size, y = index % c.dest_size;
+      uint8_t *dest = c.dest[face] + y * c.dest_size * c.bpp;
+      float rsize = 2.0f / c.dest_size;
+
+      for (unsigned x = 0; x != c.dest_size; ++x) {
+        float n[3];
+        get_dir(n, face, (x + 0.5f) * rsize - 1, (y + 0.5f) * rsize - 1);
+        float rlen = 1.0f / sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        n[0] *= rlen; n[1] *= rlen; n[2] *= rlen;
+
+        // tangent frame around the centre direction
+        float t[3], b[3];
+        if (fabsf(n[1]) < 0.9f) {
+          t[0] = n[2]; t[1] = 0; t[2] = -n[0];
+        } else {
+          t[0] = 0; t[1] = -n[2]; t[2] = n[1];
+        }
+        rlen = 1.0f / sqrtf(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+        t[0] *= rlen; t[1] *= rlen; t[2] *= rlen;
+        b[0] = n[1] * t[2] - n[2] * t[1];
+        b[1] = n[2] * t[0] - n[0] * t[2];
+        b[2] = n[0] * t[1] - n[1] * t[0];
+
+        float total[4] = { 0, 0, 0, 0 };
+        for (unsigned i = 0; i != c.num_taps; ++i) {
+          const tap &tp = c.taps[i];
+          float dir[3];
+          for (unsigned k = 0; k != 3; ++k) {
+            dir[k] = n[k] * tp.z + t[k] * tp.x + b[k] * tp.y;
+          }
+          float texel[4];
+          sample(texel, c, dir);
+          for (unsigned k = 0; k != c.bpp; ++k) {
+            total[k] += texel[k] * tp.weight;
+          }
+        }
+
+        for (unsigned k = 0; k != c.bpp; ++k) {
+          *dest++ = (uint8_t)min(total[k] * c.rtotal_weight + 0.5f, 255.0f);
+        }
+      }
+    }
+
+    // the same taps are used for every texel of a level
+    static void init_taps(context &c) {
+      float step = c.sigma * 0.5f;
+      float total_weight = 0;
+      c.num_taps = 0;
+      for (int j = -kernel_radius; j <= kernel_radius; ++j) {
+        for (int i = -kernel_radius; i <= kernel_radius; ++i) {
+          // step (i, j) along the sphere, not across the tangent plane
+          float ox = i * step, oy = j * step;
+          float angle = sqrtf(ox * ox + oy * oy);
+          if (angle > 3.14159265f) continue;
+          float sin_over_angle = angle == 0 ? 1.0f : sinf(angle) / angle;
+          tap &tp = c.taps[c.num_taps++];
+          tp.x = ox * sin_over_angle;
+          tp.y = oy * sin_over_angle;
+          tp.z = cosf(angle);
+          tp.weight = expf(-(float)(i * i + j * j) * (1.0f / 8));
+          total_weight += tp.weight;
+        }
+      }
+      c.rtotal_weight = 1.0f / total_weight;
+    }
+
+  public:
+    // pick the face for a direction, following the GL face selection rules, and find its (s, t)
+    // coordinates in [0, 1]. faces are in the chain order posx, posy, posz, negx, negy, negz.
+    static unsigned get_face(const vec3 &dir, float &s, float &t) {
+      float ax = fabsf(dir[0]), ay = fabsf(dir[1]), az = fabsf(dir[2]);
+      unsigned f;
+      float sc, tc, ma;
+      if (ax >= ay && ax >= az) {
+        ma = ax;
+        if (dir[0] >= 0) { f = 0; sc = -dir[2]; tc = -dir[1]; }
+        else { f = 3; sc = dir[2]; tc = -dir[1]; }
+      } else if (ay >= az) {
+        ma = ay;
+        if (dir[1] >= 0) { f = 1; sc = dir[0]; tc = dir[2]; }
+        else { f = 4; sc = dir[0]; tc = -dir[2]; }
+      } else {
+        ma = az;
+        if (dir[2] >= 0) { f = 2; sc = dir[0]; tc = -dir[1]; }
+        else { f = 5; sc = -dir[0]; tc = -dir[1]; }
+      }
+      float rma = ma == 0 ? 0.0f : 1.0f / ma;
+      s = (sc * rma + 1) * 0.5f;
+      t = (tc * rma + 1) * 0.5f;
+      return f;
+    }
+
+    // one over the lobe width of level 0. matches the texels of a 512x512 face.
+    static float get_lod_scale() {
+      return 2.0f * 512 / 3.14159265f;
+    }
+
+    // angular width in radians of the gaussian that level was filtered with
+    static float get_sigma(unsigned level) {
+      return ldexpf(1.0f / get_lod_scale(), (int)level);
+    }
+
+    // build a prefiltered mip chain for six decoded square faces of the same size and format.
+    // level 0 is the source image. returns a plain box filtered chain if the faces are not square.
+    static void build_mip_chain(dynarray<uint8_t> &chain, unsigned &num_levels, const resources::decoded_image *faces, unsigned num_threads = 0) {
+      // the box filtered chain is the source for each level
+      dynarray<uint8_t> box;
+      cubemap_cache::build_mip_chain(box, num_levels, faces);
+      unsigned size = faces[0].width;
+      if (faces[0].height != size) {
+        chain.resize(box.size());
+        memcpy(chain.data(), box.data(), box.size());
+        return;
+      }
+
+      unsigned bpp = faces[0].format == GL_RGB ? 3 : 4;
+      chain.resize(box.size());
+      const uint8_t *level_src[32];
+      uint8_t *level_dest[32];
+      unsigned offset = 0;
+      for (unsigned level = 0; level != num_levels; ++level) {
+        level_src[level] = box.data() + offset;
+        level_dest[level] = chain.data() + offset;
+        unsigned level_size = max(size >> level, 1u);
+        offset += level_size * level_size * bpp * 6;
+      }
+
+      unsigned level0_size = size * size * bpp * 6;
+      memcpy(chain.data(), box.data(), level0_size);
+
+      float texel_angle = 3.14159265f / (2.0f * size);
+      for (unsigned level = 1; level != num_levels; ++level) {
+        context c;
+        c.sigma = get_sigma(level);
+        c.bpp = bpp;
+        c.dest_size = max(size >> level, 1u);
+        init_taps(c);
+
+        // the smallest source level whose texels are still no wider than half a sigma
+        unsigned src_level = 0;
+        while (src_level + 1 < level && ldexpf(texel_angle, (int)src_level + 1) <= c.sigma * 0.5f) {
+          ++src_level;
+        }
+        c.src_size = max(size >> src_level, 1u);
+
+        unsigned src_face_size = c.src_size * c.src_size * bpp;
+        unsigned dest_face_size = c.dest_size * c.dest_size * bpp;
+        for (unsigned face = 0; face != 6; ++face) {
+          c.src[face] = level_src[src_level] + src_face_size * face;
+          c.dest[face] = level_dest[level] + dest_face_size * face;
+        }
+
+        thread_pool::for_each(c.dest_size * 6, filter_row, &c, num_threads);
+      }
+    }
+  };
+}
@@ -9,6 +9,14 @@
 
 namespace octet {
   class gl_resource : public resource {
+  public:
+    // gl calls made by bind and flush, see get_stats()
+    struct stats {
+      unsigned buffer_binds;
+      unsigned buffer_uploads;
+    };
+
+  private:
     // in GLES2, we need to have a second buffer containing the data
     dynarray<uint8_t> bytes;
 
@@ -18,6 +26,47 @@ namespace octet {
     // GL_ARRAY_BUFFER etc.
     GLuint target;
 
+    // byte ranges written since the last upload, [begin, end) sorted and not touching.
+    // when there are too many, they are merged into one.
+    enum { max_dirty_ranges = 8 };
+    unsigned num_dirty_ranges;
+    unsigned dirty_begin[max_dirty_ranges];
+    unsigned dirty_end[max_dirty_ranges];
+
+    // while non-zero, bind() does not upload. see batch.
+    unsigned batch_depth;
+
+    // add [begin, end) to the dirty ranges, merging any it overlaps or touches
+    void add_dirty_range(unsigned begin, unsigned end) {
+      if (begin >= end) return;
+
+      unsigned i = 0;
+      while (i != num_dirty_ranges && dirty_end[i] < begin) ++i;
+      unsigned j = i;
+      while (j != num_dirty_ranges && dirty_begin[j] <= end) {
+        begin = min(begin, dirty_begin[j]);
+        end = max(end, dirty_end[j]);
+        ++j;
+      }
+
+      if (i == j && num_dirty_ranges == max_dirty_ranges) {
+        // no room, upload everything from the first to the last range
+        dirty_begin[0] = min(begin, dirty_begin[0]);
+        dirty_end[0] = max(end, dirty_end[num_dirty_ranges-1]);
+        num_dirty_ranges = 1;
+        return;
+      }
+
+      // replace ranges [i, j) with the new one
+      unsigned num_after = num_dirty_ranges - j;
+      unsigned new_pos = i + 1;
+      memmove(dirty_begin + new_pos, dirty_begin + j, num_after * sizeof(unsigned));
+      memmove(dirty_end + new_pos, dirty_end + j, num_after * sizeof(unsigned));
+      dirty_begin[i] = begin;
+      dirty_end[i] = end;
+      num_dirty_ranges = new_pos + num_after;
+    }
+
   public:
     // helper classes so that we remember to unlock!
 
@@ -25,9 +74,12 @@ namespace octet {
     class rwlock {
       gl_resource *res;
       void *ptr;
+      bool whole;
     public:
-      rwlock(gl_resource *res) { this->res = res; ptr = res->lock(); }
-      ~rwlock() { res->unlock(); }
+      rwlock(gl_resource *res) { this->res = res; ptr = res->lock(); whole = true; }
+      // lock only size bytes from offset; u8() etc. still point to the start of the buffer
+      rwlock(gl_resource *res, unsigned offset, unsigned size) { this->res = res; ptr = res->lock(); whole = false; res->mark_dirty(offset, size); }
+      ~rwlock() { if (whole) res->unlock(); }
       uint8_t *u8() const { return (uint8_t*)ptr; }
       uint16_t *u16() const { return (uint16_t*)ptr; }
       uint32_t *u32() const { return (uint32_t*)ptr; }
@@ -46,11 +98,22 @@ namespace octet {
       const uint32_t *u32() const { return (const uint32_t*)ptr; }
       const float *f32() const { return (const float*)ptr; }
     };
+
+    // uploads are held back until the end of a batch, eg. when editing a mesh that is also drawn.
+    //   { gl_resource::batch b(mesh->get_vertices()); ... many set_value calls ... }
+    class batch {
+      gl_resource *res;
+    public:
+      batch(gl_resource *res) { this->res = res; res->batch_depth++; }
+      ~batch() { if (--res->batch_depth == 0) res->flush(); }
+    };
   public:
     RESOURCE_META(gl_resource)
 
     gl_resource(unsigned target=0, unsigned size=0) {
       buffer = 0;
+      num_dirty_ranges = 0;
+      batch_depth = 0;
       this->target = target;
       if (size) {
         allocate(target, size);
@@ -61,16 +124,18 @@ namespace octet {
     void visit(visitor &v) {
       v.visit(bytes, atom_bytes);
       v.visit(target, atom_target);
+
+      // a loaded buffer has not been uploaded yet
+      mark_dirty(0, bytes.size());
     }
 
-    // 
+    // size bytes in memory. the gl buffer is made on the first bind, so meshes can be
+    // built and ray cast before there is a GL context.
     void allocate(GLuint target, unsigned size) {
       reset();
-      glGenBuffers(1, &buffer);
-      glBindBuffer(target, buffer);
-      glBufferData(target, size, NULL, GL_STATIC_DRAW);
       bytes.resize(size);
       this->target = target;
+      mark_dirty(0, size);
     }
 
     void reset() {
@@ -79,6 +144,7 @@ namespace octet {
       }
       bytes.reset();
       buffer = 0;
+      num_dirty_ranges = 0;
     }
 
     ~gl_resource() {
@@ -110,27 +176,81 @@ namespace octet {
       //return glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT);
     }
 
+    // the whole buffer may have been written. it is uploaded on the next bind.
     void unlock() const {
-      glBindBuffer(target, buffer);
-      glBufferSubData(target, 0, bytes.size(), &bytes[0]);
-      //glUnmapBuffer(target);
+      ((gl_resource*)this)->mark_dirty(0, bytes.size());
+    }
+
+    // size bytes from offset have been written and need uploading
+    void mark_dirty(unsigned offset, unsigned size) {
+      assert(offset + size <= get_size());
+      add_dirty_range(offset, offset + size);
+    }
+
+    bool is_dirty() const {
+      return num_dirty_ranges != 0;
+    }
+
+    // upload the dirty ranges now. called by bind and at the end of a batch.
+    // leaves the buffer bound.
+    void flush() {
+      if (!num_dirty_ranges) return;
+      if (!buffer) {
+        // eg. loaded from a file
+        glGenBuffers(1, &buffer);
+        glBindBuffer(target, buffer);
+        glBufferData(target, bytes.size(), &bytes[0], GL_STATIC_DRAW);
+        get_stats().buffer_binds++;
+        get_stats().buffer_uploads += 2;
+      } else {
+        glBindBuffer(target, buffer);
+        get_stats().buffer_binds++;
+        if (num_dirty_ranges == 1 && dirty_begin[0] == 0 && dirty_end[0] == bytes.size()) {
+          // let the driver replace the whole buffer instead of waiting for draws using it
+          glBufferData(target, bytes.size(), &bytes[0], GL_STATIC_DRAW);
+          get_stats().buffer_uploads++;
+        } else {
+          for (unsigned i = 0; i != num_dirty_ranges; ++i) {
+            glBufferSubData(target, dirty_begin[i], dirty_end[i] - dirty_begin[i], &bytes[dirty_begin[i]]);
+          }
+          get_stats().buffer_uploads += num_dirty_ranges;
+        }
+      }
+      num_dirty_ranges = 0;
     }
 
+    // bind the buffer, uploading any changes first (unless in a batch)
     void bind() const {
-      glBindBuffer(target, buffer);
+      gl_resource *self = (gl_resource*)this;
+      if (num_dirty_ranges && !batch_depth) {
+        self->flush();
+      } else {
+        glBindBuffer(target, buffer);
+        get_stats().buffer_binds++;
+      }
     }
 
     void assign(void *ptr, unsigned offset, unsigned size) {
       assert(offset + size <= this->get_size());
 
       memcpy((void*)((char*)lock() + offset), ptr, size);
-      unlock();
+      mark_dirty(offset, size);
     }
 
     void copy(const gl_resource *rhs) {
       allocate(rhs->get_target(), rhs->get_size());
-      assign(rhs->lock(), 0, rhs->get_size());
-      rhs->unlock();
+      assign((void*)rhs->lock_read_only(), 0, rhs->get_size());
+      rhs->unlock_read_only();
+    }
+
+    // counters for all buffers. buffer_uploads counts glGenBuffers, glBufferData and glBufferSubData.
+    static stats &get_stats() {
+      static stats s;
+      return s;
+    }
+
+    static void reset_stats() {
+      memset(&get_stats(), 0, sizeof(stats));
     }
   };
 }
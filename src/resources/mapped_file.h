@@ -0,0 +1,131 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// read only view of a whole file
+//
+
+#if defined(WIN32)
+  // windows.h is included by the platform header
+#elif defined(__APPLE__) || defined(__linux__)
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+  #define OCTET_MMAP 1
+#endif
+
+namespace octet {
+  /*
+   * mapped_file - maps a file into memory, read only.
+   *
+   * The pages are only read from disk when they are touched, so large binary files
+   * (eg. cube map caches) can be used in place without a copy.
+   * Where there is no mmap, the file is read into a buffer instead.
+   */
+  class mapped_file {
+    const uint8_t *data_;
+    unsigned size_;
+
+    #if defined(WIN32)
+      HANDLE file_;
+      HANDLE mapping_;
+    #elif defined(OCTET_MMAP)
+      void *map_;
+    #else
+      dynarray<uint8_t> buffer_;
+    #endif
+
+  public:
+    mapped_file() {
+      data_ = 0;
+      size_ = 0;
+      #if defined(WIN32)
+        file_ = INVALID_HANDLE_VALUE;
+        mapping_ = 0;
+      #elif defined(OCTET_MMAP)
+        map_ = 0;
+      #endif
+    }
+
+    ~mapped_file() {
+      close();
+    }
+
+    // map a file by its path (not a url). returns false if it can not be opened.
+    bool open(const char *path) {
+      close();
+      #if defined(WIN32)
+        file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size) || size.HighPart || !size.LowPart) {
+          close();
+          return false;
+        }
+        mapping_ = CreateFileMapping(file_, 0, PAGE_READONLY, 0, 0, 0);
+        data_ = mapping_ ? (const uint8_t*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0) : 0;
+        if (!data_) {
+          close();
+          return false;
+        }
+        size_ = size.LowPart;
+      #elif defined(OCTET_MMAP)
+        int file = ::open(path, O_RDONLY);
+        if (file < 0) return false;
+        struct stat file_stat;
+        if (fstat(file, &file_stat) != 0 || file_stat.st_size == 0) {
+          ::close(file);
+          return false;
+        }
+        map_ = mmap(0, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        // the mapping keeps the file open
+        ::close(file);
+        if (map_ == MAP_FAILED) {
+          map_ = 0;
+          return false;
+        }
+        data_ = (const uint8_t*)map_;
+        size_ = (unsigned)file_stat.st_size;
+      #else
+        FILE *file = fopen(path, "rb");
+        if (!file) return false;
+        fseek(file, 0, SEEK_END);
+        buffer_.resize((unsigned)ftell(file));
+        fseek(file, 0, SEEK_SET);
+        fread(buffer_.data(), 1, buffer_.size(), file);
+        fclose(file);
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+      #endif
+      return true;
+    }
+
+    void close() {
+      #if defined(WIN32)
+        if (data_) UnmapViewOfFile(data_);
+        if (mapping_) CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+        mapping_ = 0;
+        file_ = INVALID_HANDLE_VALUE;
+      #elif defined(OCTET_MMAP)
+        if (map_) munmap(map_, size_);
+        map_ = 0;
+      #else
+        buffer_.reset();
+      #endif
+      data_ = 0;
+      size_ = 0;
+    }
+
+    const uint8_t *data() const {
+      return data_;
+    }
+
+    unsigned size() const {
+      return size_;
+    }
+  };
+}
@@ -13,7 +13,8 @@ namespace octet {
   class mesh_builder {
     struct vertex { float pos[3]; float normal[3]; float tangent[3]; float uv[2]; };
     dynarray<vertex, allocator> vertices;
-    dynarray<unsigned short, allocator> indices;
+    // 32 bit while building; get_mesh uses 16 bit indices when they fit
+    dynarray<uint32_t, allocator> indices;
 
     struct sphere {
       vec4 center;
@@ -31,7 +32,7 @@ namespace octet {
 
     // For a cube, add the front face. Matrix transforms are used to add the others.
     void add_front_face(float size) {
-      unsigned short cur_vertex = (unsigned short)vertices.size();
+      unsigned cur_vertex = (unsigned)vertices.size();
       add_vertex(vec4(-size, -size, size, 1), vec4(0, 0, 1, 0), vec4(0, 0, 1, 0), 0, 0);
       add_vertex(vec4(-size,  size, size, 1), vec4(0, 0, 1, 0), vec4(0, 0, 1, 0), 0, 1);
       add_vertex(vec4( size,  size, size, 1), vec4(0, 0, 1, 0), vec4(0, 0, 1, 0), 1, 1);
@@ -44,6 +45,21 @@ namespace octet {
       indices.push_back(cur_vertex+3);
     }
 
+    // the front face seen from inside the cube: normal points in and the winding is reversed.
+    void add_inside_front_face(float size) {
+      unsigned cur_vertex = (unsigned)vertices.size();
+      add_vertex(vec4(-size, -size, size, 1), vec4(0, 0, -1, 0), vec4(0, 0, -1, 0), 0, 0);
+      add_vertex(vec4(-size,  size, size, 1), vec4(0, 0, -1, 0), vec4(0, 0, -1, 0), 0, 1);
+      add_vertex(vec4( size,  size, size, 1), vec4(0, 0, -1, 0), vec4(0, 0, -1, 0), 1, 1);
+      add_vertex(vec4( size, -size, size, 1), vec4(0, 0, -1, 0), vec4(0, 0, -1, 0), 1, 0);
+      indices.push_back(cur_vertex+0);
+      indices.push_back(cur_vertex+2);
+      indices.push_back(cur_vertex+1);
+      indices.push_back(cur_vertex+0);
+      indices.push_back(cur_vertex+3);
+      indices.push_back(cur_vertex+2);
+    }
+
     // modified add_ring in order to include tangent
     // add a ring in the x-y plane. Return index of first index
     unsigned add_ring(float radius, const vec4 &normal, const vec4 &tangent, unsigned num_vertices, float v, float uvscale) {
@@ -112,6 +128,36 @@ namespace octet {
       matrix = save_matrix;
     }
 
+    // add one side of a CD: num_segments+1 rings of num_vertices+1 vertices (the first and last
+    // vertex of a ring meet at the seam) from inner_radius to outer_radius.
+    // returns the first vertex.
+    unsigned add_CD_side(float inner_radius, float outer_radius, float v, float uvscale, unsigned num_vertices, unsigned num_segments) {
+      unsigned first_vertex = (unsigned)vertices.size();
+      for (unsigned j = 0; j <= num_segments; j++) {
+        float radius = inner_radius + (outer_radius - inner_radius) * float(j) / float(num_segments);
+        add_ring(radius, vec4(0, 0, 1, 0), vec4(0, 1, 0, 0), num_vertices, v, uvscale);
+      }
+      return first_vertex;
+    }
+
+    // triangles of one side using every step'th vertex around and across
+    void add_CD_side_indices(unsigned first_vertex, unsigned num_vertices, unsigned num_segments, unsigned step) {
+      unsigned ring_size = num_vertices + 1;
+      for (unsigned j = 0; j < num_segments; j += step) {
+        unsigned inner_vertex = first_vertex + j * ring_size;
+        unsigned outer_vertex = inner_vertex + step * ring_size;
+        for (unsigned i = 0; i < num_vertices; i += step) {
+          indices.push_back(inner_vertex + i);
+          indices.push_back(inner_vertex + i + step);
+          indices.push_back(outer_vertex + i);
+
+          indices.push_back(inner_vertex + i + step);
+          indices.push_back(outer_vertex + i + step);
+          indices.push_back(outer_vertex + i);
+        }
+      }
+    }
+
   public:
     mesh_builder() {
       init();
@@ -160,6 +206,24 @@ namespace octet {
       matrix.rotateX90();
     }
 
+    // add a cube to be seen from the inside, eg. a sky box
+    void add_inside_out_cube(float size) {
+      add_inside_front_face(size);
+      matrix.rotateY90();
+      add_inside_front_face(size);
+      matrix.rotateY90();
+      add_inside_front_face(size);
+      matrix.rotateY90();
+      add_inside_front_face(size);
+      matrix.rotateY90();
+
+      matrix.rotateX90();
+      add_inside_front_face(size);
+      matrix.rotateX180();
+      add_inside_front_face(size);
+      matrix.rotateX90();
+    }
+
     // add a subdivided size*size plane with nx*ny squares
     void add_plane(float size, unsigned nx, unsigned ny) {
       float xsize = size / nx;
@@ -167,7 +231,7 @@ namespace octet {
       float sizeBy2 = size * 0.5f;
       for (unsigned i = 0; i != nx; ++i) {
         for (unsigned j = 0; j != ny; ++j) {
-          unsigned short cur_vertex = (unsigned short)vertices.size();
+          unsigned cur_vertex = (unsigned)vertices.size();
           add_vertex(vec4( i*xsize+sizeBy2, j*ysize+sizeBy2, 0, 1), vec4(0, 0, 1, 0), vec4(0, 0, 1, 0), 0, 0);
           add_vertex(vec4( i*xsize+sizeBy2, (j+1)*ysize+sizeBy2, 0, 1), vec4(0, 0, 1, 0), vec4(0, 0, 1, 0), 0, 1);
           add_vertex(vec4( (i+1)*xsize+sizeBy2, (j+1)*ysize+sizeBy2, 0, 1), vec4(0, 0, 1, 0), vec4(0, 0, 1, 0), 1, 1);
@@ -195,58 +259,74 @@ namespace octet {
       add_cone_or_sphere(radius, height, slices, stacks, uvscale, false);
 
     }
-    //Add a CD for the difraction
-    void add_one_CD(float inner_radius, float outer_radius, float v, float uvscale) {
-      unsigned short num_vertices = 30;
-      unsigned short num_segments = 10;
-
+    // add both sides of a CD as a chain of levels of detail sharing one set of vertices.
+    // level 0 has num_vertices around and num_segments across; each level after that
+    // uses every other vertex of the one before, so num_vertices and num_segments should
+    // be divisible by 2^(num_lods-1). levels that would be too coarse are dropped.
+    // the indices of level i go from level_first_index[i] to level_first_index[i+1],
+    // so level_first_index needs num_lods+1 entries. returns the number of levels made.
+    unsigned add_CD_lods(
+      float inner_radius, float outer_radius, float v, float uvscale,
+      unsigned num_vertices, unsigned num_segments, unsigned num_lods, unsigned *level_first_index
+    ) {
       translate(0.0f, 0.0f, 0.02f);
-      unsigned short inner_vertex = (unsigned short)vertices.size();
-      add_ring(inner_radius, vec4(0, 0, 1, 1), vec4(0, 1, 0, 1), num_vertices, v, uvscale);
-
-      for (int j = 0; j != num_segments; j++) {
-        unsigned short outer_vertex = (unsigned short)vertices.size();
-        add_ring(inner_radius + (outer_radius-inner_radius)*float(j)/float(num_segments), vec4(0, 0, 1, 1), vec4(0, 1, 0, 1), num_vertices, v, uvscale);
-
-        for (int i = 0; i != num_vertices+1; i++) {
-          indices.push_back(inner_vertex+i);
-          indices.push_back(inner_vertex+((i+1)%(num_vertices+1)));
-          indices.push_back(outer_vertex+i);
-
-          indices.push_back(inner_vertex+((i+1)%(num_vertices+1)));
-          indices.push_back(outer_vertex+((i+1)%(num_vertices+1)));
-          indices.push_back(outer_vertex+i);
-        }
-        inner_vertex = outer_vertex;
-      }
+      unsigned front = add_CD_side(inner_radius, outer_radius, v, uvscale, num_vertices, num_segments);
 
       translate(0.0f, 0.0f, -0.02f);
       matrix.rotateY180();
       translate(0.0f, 0.0f, 0.02f);
-      
-      inner_vertex = (unsigned short)vertices.size();
-      add_ring(inner_radius, vec4(0, 0, 1, 1), vec4(0, 1, 0, 1), num_vertices, v, uvscale);
-
-      for (int j = 0; j != num_segments; j++) {
-        unsigned short outer_vertex = (unsigned short)vertices.size();
-        add_ring(inner_radius + (outer_radius-inner_radius)*float(j)/float(num_segments), vec4(0, 0, 1, 1), vec4(0, 1, 0, 1), num_vertices, v, uvscale);
-
-        for (int i = 0; i != num_vertices+1; i++) {
-          indices.push_back(inner_vertex+i);
-          indices.push_back(inner_vertex+((i+1)%(num_vertices+1)));
-          indices.push_back(outer_vertex+i);
-
-          indices.push_back(inner_vertex+((i+1)%(num_vertices+1)));
-          indices.push_back(outer_vertex+((i+1)%(num_vertices+1)));
-          indices.push_back(outer_vertex+i);
-        }
-        inner_vertex = outer_vertex;
+      unsigned back = add_CD_side(inner_radius, outer_radius, v, uvscale, num_vertices, num_segments);
+
+      // put the matrix back where it was
+      translate(0.0f, 0.0f, -0.02f);
+      matrix.rotateY180();
+
+      unsigned level = 0;
+      for (unsigned step = 1; level != num_lods; ++level, step *= 2) {
+        if (num_vertices % step || num_segments % step || num_vertices / step < 3) break;
+        level_first_index[level] = indices.size();
+        add_CD_side_indices(front, num_vertices, num_segments, step);
+        add_CD_side_indices(back, num_vertices, num_segments, step);
       }
+      level_first_index[level] = indices.size();
+      return level;
+    }
+
+    //Add a CD for the difraction
+    //num_vertices is the number of vertices around each ring and num_segments the number of rings.
+    void add_one_CD(float inner_radius, float outer_radius, float v, float uvscale, unsigned num_vertices = 30, unsigned num_segments = 10) {
+      unsigned level_first_index[2];
+      add_CD_lods(inner_radius, outer_radius, v, uvscale, num_vertices, num_segments, 1, level_first_index);
     }
 
     // get a mesh mesh from the builder either as VBOs or allocated memory.
     void get_mesh(mesh &s);
 
+    // raw access to the vertices and indices, eg. for rendering without GL
+    unsigned get_num_vertices() const {
+      return (unsigned)vertices.size();
+    }
+
+    unsigned get_num_indices() const {
+      return (unsigned)indices.size();
+    }
+
+    const float *get_pos(unsigned i) const {
+      return vertices[i].pos;
+    }
+
+    const float *get_normal(unsigned i) const {
+      return vertices[i].normal;
+    }
+
+    const float *get_tangent(unsigned i) const {
+      return vertices[i].tangent;
+    }
+
+    unsigned get_index(unsigned i) const {
+      return indices[i];
+    }
+
     void scale(float x, float y, float z) {
       matrix.scale(x, y, z);
     }
@@ -29,6 +29,9 @@ namespace octet {
     static GLuint get_texture_handle_internal(unsigned gl_kind, const char *name);
     static GLuint get_cubemap_texture_handle_internal(unsigned gl_kind, const char *name, const char *posx, const char *posy, const char *posz, const char *negx, const char *negy, const char *negz);
 
+    // see get_images
+    static void get_images_worker(void *context, unsigned index);
+
     static unsigned u4(unsigned char *src) {
       return src[0] + src[1] * 256 + src[2] * 65536 + src[3] * 0x1000000;
     }
@@ -104,6 +107,30 @@ namespace octet {
       }
     }
 
+    // decode a gif, jpeg or tga file in memory. does not touch GL, so it can run on any thread.
+    static bool decode_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max);
+
+    // load and decode an image without making a texture
+    static bool get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const char *url);
+
+    // one result of get_images
+    struct decoded_image {
+      dynarray<uint8_t> pixels;
+      uint16_t format;
+      uint16_t width;
+      uint16_t height;
+      bool ok;
+
+      // the file contents while loading
+      dynarray<uint8_t> file;
+    };
+
+    // load and decode several images at once, each on its own thread where possible.
+    // files are read and decoded on the workers; zip:// urls are read on the calling thread.
+    // an image whose file is already read is decoded from that.
+    // returns true if all the images loaded.
+    static bool get_images(decoded_image *images, const char *const *urls, unsigned num_images, unsigned num_threads = 0);
+
     // factory for textures
     static GLuint get_texture_handle(unsigned gl_kind, const char *name) {
       GLuint &result = textures()[name];
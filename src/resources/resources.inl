@@ -8,6 +8,34 @@
 //
 
 namespace octet {
+  bool resources::decode_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
+    format = width = height = 0;
+    unsigned size = (unsigned)(src_max - src);
+    if (size >= 6 && !memcmp(src, "GIF89a", 6)) {
+      gif_decoder dec;
+      dec.get_image(image, format, width, height, src, src_max);
+    } else if (size >= 6 && src[0] == 0xff && src[1] == 0xd8) {
+      jpeg_decoder dec;
+      dec.get_image(image, format, width, height, src, src_max);
+    } else if (size >= 6 && src[0] == 0 && src[1] == 0 && src[2] == 2) {
+      tga_decoder dec;
+      dec.get_image(image, format, width, height, src, src_max);
+    } else {
+      return false;
+    }
+    return width > 0 && height > 0 && format;
+  }
+
+  bool resources::get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const char *url) {
+    dynarray<uint8_t> buffer;
+    app_utils::get_url(buffer, url);
+    if (buffer.size() == 0) {
+      format = width = height = 0;
+      return false;
+    }
+    return decode_image(image, format, width, height, &buffer[0], &buffer[0] + buffer.size());
+  }
+
   // todo: kill this
   GLuint resources::get_texture_handle_internal(unsigned gl_kind, const char *url) {
     if (url[0] == '!') {
@@ -15,24 +43,11 @@ namespace octet {
     } else if (url[0] == '#') {
       return app_utils::get_solid_texture(gl_kind, url+1);
     } else {
-      dynarray<uint8_t> buffer;
       dynarray<uint8_t> image;
-      app_utils::get_url(buffer, url);
       uint16_t format = 0;
       uint16_t width = 0;
       uint16_t height = 0;
-      const unsigned char *src = &buffer[0];
-      const unsigned char *src_max = src + buffer.size();
-      if (buffer.size() >= 6 && !memcmp(&buffer[0], "GIF89a", 6)) {
-        gif_decoder dec;
-        dec.get_image(image, format, width, height, src, src_max);
-      } else if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
-        jpeg_decoder dec;
-        dec.get_image(image, format, width, height, src, src_max);
-      } else if (buffer.size() >= 6 && buffer[0] == 0 && buffer[1] == 0 && buffer[2] == 2) {
-        tga_decoder dec;
-        dec.get_image(image, format, width, height, src, src_max);
-      } else {
+      if (!get_image(image, format, width, height, url)) {
         printf("warning: unknown texture format\n");
         return 0;
       }
@@ -46,107 +61,86 @@ namespace octet {
     }
   };
 
-  GLuint resources::get_cubemap_texture_handle_internal(unsigned gl_kind, const char *texName,
-    const char *posx, const char *posy, const char *posz,
-    const char *negx, const char *negy, const char *negz) {
-    
-      dynarray<uint8_t> buffer;
-      dynarray<uint8_t> posx_image;
-      dynarray<uint8_t> posy_image;
-      dynarray<uint8_t> posz_image;
-      dynarray<uint8_t> negx_image;
-      dynarray<uint8_t> negy_image;
-      dynarray<uint8_t> negz_image;
-
-      posx_image.reset();
-      posy_image.reset();
-      posz_image.reset();
-      negx_image.reset();
-      negy_image.reset();
-      negz_image.reset();
+  struct get_images_context {
+    resources::decoded_image *images;
+    const char *const *urls;
+  };
 
-      uint16_t format = 0;
-      uint16_t width = 0;
-      uint16_t height = 0;
+  void resources::get_images_worker(void *context, unsigned index) {
+    get_images_context *ctxt = (get_images_context*)context;
+    resources::decoded_image &img = ctxt->images[index];
+    dynarray<uint8_t> &file = img.file;
+    if (file.size() == 0) {
+      app_utils::get_url(file, ctxt->urls[index]);
+    }
+    img.ok = file.size() != 0 && decode_image(img.pixels, img.format, img.width, img.height, file.data(), file.data() + file.size());
+    file.reset();
+  }
 
-      buffer.reset();
-      app_utils::get_url(buffer, posx);
-      unsigned char *src = &buffer[0];
-      unsigned char *src_max = src + buffer.size();
-      if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
-        jpeg_decoder dec;
-        dec.get_image(posx_image, format, width, height, src, src_max);
-      } else {
-        printf("warning: cube map only accepts JPEG format. posx.\n");
-        return 0;
+  bool resources::get_images(decoded_image *images, const char *const *urls, unsigned num_images, unsigned num_threads) {
+    for (unsigned i = 0; i != num_images; ++i) {
+      images[i].format = images[i].width = images[i].height = 0;
+      images[i].ok = false;
+      // the zip file cache is shared, so only plain files are read on the workers
+      if (images[i].file.size() == 0 && !strncmp(urls[i], "zip://", 6)) {
+        app_utils::get_url(images[i].file, urls[i]);
       }
+    }
 
-      buffer.reset();
-      app_utils::get_url(buffer, posy);
-      src = &buffer[0];
-      src_max = src + buffer.size();
-      if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
-        jpeg_decoder dec;
-        dec.get_image(posy_image, format, width, height, src, src_max);
-      } else {
-        printf("warning: cube map only accepts JPEG format. posy.\n");
-        return 0;
-      } 
+    get_images_context ctxt = { images, urls };
+    thread_pool::for_each(num_images, get_images_worker, &ctxt, num_threads);
 
-      buffer.reset();
-      app_utils::get_url(buffer, posz);
-      src = &buffer[0];
-      src_max = src + buffer.size();
-      if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
-        jpeg_decoder dec;
-        dec.get_image(posz_image, format, width, height, src, src_max);
-      } else {
-        printf("warning: cube map only accepts JPEG format. posz.\n");
-        return 0;
+    bool ok = true;
+    for (unsigned i = 0; i != num_images; ++i) {
+      if (!images[i].ok) {
+        printf("warning: could not load image %s\n", urls[i]);
+        ok = false;
       }
+    }
+    return ok;
+  }
 
-      buffer.reset();
-      app_utils::get_url(buffer, negx);
-      src = &buffer[0];
-      src_max = src + buffer.size();
-      if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
-        jpeg_decoder dec;
-        dec.get_image(negx_image, format, width, height, src, src_max);
-      } else {
-        printf("warning: cube map only accepts JPEG format. negx.\n");
-        return 0;
-      } 
+  GLuint resources::get_cubemap_texture_handle_internal(unsigned gl_kind, const char *texName,
+    const char *posx, const char *posy, const char *posz,
+    const char *negx, const char *negy, const char *negz) {
+    const char *urls[6] = { posx, posy, posz, negx, negy, negz };
+    decoded_image faces[6];
 
-      buffer.reset();
-      app_utils::get_url(buffer, negy);
-      src = &buffer[0];
-      src_max = src + buffer.size();
-      if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
-        jpeg_decoder dec;
-        dec.get_image(negy_image, format, width, height, src, src_max);
-      } else {
-        printf("warning: cube map only accepts JPEG format. negy.\n");
-        return 0;
-      }
+    // the cache key is a hash of the source files, so read them first
+    for (unsigned i = 0; i != 6; ++i) {
+      faces[i].ok = false;
+      app_utils::get_url(faces[i].file, urls[i]);
+    }
+    uint64_t key = cubemap_cache::get_key(faces, 6);
+    string cache_path;
+    bool cacheable = cubemap_cache::get_path(cache_path, posx, texName);
+    if (cacheable) {
+      GLuint handle = cubemap_cache::load_texture(gl_kind, cache_path, key);
+      if (handle) return handle;
+    }
 
-      buffer.reset();
-      app_utils::get_url(buffer, negz);
-      src = &buffer[0];
-      src_max = src + buffer.size();
-      if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
-        jpeg_decoder dec;
-        dec.get_image(negz_image, format, width, height, src, src_max);
-      } else {
-        printf("warning: cube map only accepts JPEG format. negz.\n");
-        return 0;
-      }
+    // decode the six faces in parallel, then upload them together
+    if (!get_images(faces, urls, 6)) {
+      return 0;
+    }
 
-      if (width > 0 && height > 0 && format) {
-        return app_utils::make_cubemap_texture(format, posx_image.size(), format, width, height,
-          &posx_image[0], &posy_image[0], &posz_image[0], &negx_image[0], &negy_image[0], &negz_image[0]);
-      } else
-      {
+    for (unsigned i = 1; i != 6; ++i) {
+      if (faces[i].format != faces[0].format || faces[i].width != faces[0].width || faces[i].height != faces[0].height) {
+        printf("warning: cube map %s faces do not match. %s\n", texName, urls[i]);
         return 0;
       }
-  };
+    }
+
+    // rougher reflections read the smaller levels, see get_reflection_glsl
+    dynarray<uint8_t> chain;
+    unsigned num_levels = 0;
+    cubemap_prefilter::build_mip_chain(chain, num_levels, faces);
+    if (cacheable && cubemap_cache::save(cache_path, key, faces[0].format, faces[0].width, faces[0].height, num_levels, chain)) {
+      GLuint handle = cubemap_cache::load_texture(gl_kind, cache_path, key);
+      if (handle) return handle;
+    }
+
+    // zip files and read only directories can not be cached, so upload the chain as it is
+    return cubemap_cache::make_texture(gl_kind, faces[0].format, faces[0].width, faces[0].height, num_levels, chain);
+  }
 }
@@ -0,0 +1,124 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// run independent pieces of work on several threads
+//
+
+#if defined(WIN32)
+  // windows.h is included by the platform header
+#elif defined(__APPLE__) || defined(__linux__)
+  #include <pthread.h>
+  #include <unistd.h>
+  #define OCTET_PTHREADS 1
+#endif
+
+namespace octet {
+  /*
+   * thread_pool - calls fn(context, index) for every index in [0, count), spread over
+   * worker threads, and returns when they have all finished.
+   *
+   * The work items pull indices from a shared counter, so uneven items balance out.
+   * The callback must not use GL or the shared octet statics (eg. app_utils::get_path);
+   * load files on the calling thread and pass the bytes in the context.
+   * On platforms without threads, the items run one after the other on the caller.
+   */
+  class thread_pool {
+  public:
+    typedef void (*work_fn)(void *context, unsigned index);
+
+  private:
+    struct work {
+      work_fn fn;
+      void *context;
+      unsigned count;
+      volatile long next;
+    };
+
+    static unsigned get_next(work *w) {
+      #if defined(WIN32)
+        return (unsigned)InterlockedIncrement(&w->next) - 1;
+      #elif defined(OCTET_PTHREADS)
+        return (unsigned)__sync_fetch_and_add(&w->next, 1);
+      #else
+        return (unsigned)w->next++;
+      #endif
+    }
+
+    static void run_worker(work *w) {
+      for (unsigned i = get_next(w); i < w->count; i = get_next(w)) {
+        w->fn(w->context, i);
+      }
+    }
+
+    #if defined(WIN32)
+      static DWORD WINAPI thread_main(LPVOID param) {
+        run_worker((work*)param);
+        return 0;
+      }
+    #elif defined(OCTET_PTHREADS)
+      static void *thread_main(void *param) {
+        run_worker((work*)param);
+        return 0;
+      }
+    #endif
+
+  public:
+    // number of hardware threads, at least one
+    static unsigned get_num_cpus() {
+      #if defined(WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+      #elif defined(OCTET_PTHREADS)
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? (unsigned)n : 1;
+      #else
+        return 1;
+      #endif
+    }
+
+    // run fn on up to num_threads threads (0 = one per cpu). the caller is one of the workers.
+    static void for_each(unsigned count, work_fn fn, void *context, unsigned num_threads = 0) {
+      work w;
+      w.fn = fn;
+      w.context = context;
+      w.count = count;
+      w.next = 0;
+
+      if (num_threads == 0) num_threads = get_num_cpus();
+      if (num_threads > count) num_threads = count;
+      if (num_threads <= 1) {
+        run_worker(&w);
+        return;
+      }
+
+      #if defined(WIN32)
+        dynarray<HANDLE> threads;
+        for (unsigned i = 1; i < num_threads; ++i) {
+          HANDLE handle = CreateThread(NULL, 0, thread_main, &w, 0, NULL);
+          if (handle) threads.push_back(handle);
+        }
+        run_worker(&w);
+        for (unsigned i = 0; i != threads.size(); ++i) {
+          WaitForSingleObject(threads[i], INFINITE);
+          CloseHandle(threads[i]);
+        }
+      #elif defined(OCTET_PTHREADS)
+        dynarray<pthread_t> threads;
+        for (unsigned i = 1; i < num_threads; ++i) {
+          pthread_t thread;
+          if (!pthread_create(&thread, NULL, thread_main, &w)) threads.push_back(thread);
+        }
+        run_worker(&w);
+        for (unsigned i = 0; i != threads.size(); ++i) {
+          pthread_join(threads[i], NULL);
+        }
+      #else
+        run_worker(&w);
+      #endif
+    }
+  };
+}
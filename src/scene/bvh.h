@@ -0,0 +1,265 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// bounding volume hierarchy for ray casts
+//
+
+namespace octet {
+  /*
+   * bvh - a tree of boxes over a set of items, eg. the triangles of a mesh or the
+   * instances of a scene, so that a ray only tests the items near it.
+   *
+   * The tree is built top down, splitting each node at the median of the item centres
+   * along its longest axis, until there are at most max_leaf_items items in a node.
+   * The two children of a node are next to each other in the node array.
+   *
+   * cast() walks the nodes hit by the segment start + t * distance (0 <= t <= t_max),
+   * nearest first, and calls hit(item, t_max) for the items in each leaf. hit returns
+   * true and reduces t_max when the item is hit, so nodes further away are skipped.
+   * cast_leaves() calls hit(first, count, t_max) once per leaf instead, so that the
+   * items of a leaf can be tested together, eg. four triangles in SSE lanes.
+   * Once built, casting does not write to the tree and can be done from several threads.
+   */
+  class bvh {
+  public:
+    enum { max_leaf_items = 4, max_depth = 64 };
+
+    // count == 0: an interior node with children first and first + 1.
+    // otherwise a leaf with items get_item(first) ... get_item(first + count - 1)
+    struct node {
+      float min[3];
+      unsigned first;
+      float max[3];
+      unsigned count;
+    };
+
+  private:
+    dynarray<node> nodes;
+    dynarray<unsigned> items;
+
+    struct centre {
+      float v[3];
+    };
+
+    // in place quickselect: partially sort items[begin, end) so that items[mid] has the median centre.
+    // three way partitions keep this quick when many centres are the same, eg. a flat grid.
+    static void select(unsigned *items, const centre *centres, unsigned axis, unsigned begin, unsigned mid, unsigned end) {
+      while (end - begin > 1) {
+        float pivot = centres[items[(begin + end) / 2]].v[axis];
+        // [begin, lt) < pivot, [lt, i) == pivot, [gt, end) > pivot
+        unsigned lt = begin, i = begin, gt = end;
+        while (i != gt) {
+          float v = centres[items[i]].v[axis];
+          if (v < pivot) {
+            unsigned tmp = items[i]; items[i++] = items[lt]; items[lt++] = tmp;
+          } else if (v > pivot) {
+            unsigned tmp = items[i]; items[i] = items[--gt]; items[gt] = tmp;
+          } else {
+            ++i;
+          }
+        }
+        if (mid < lt) {
+          end = lt;
+        } else if (mid >= gt) {
+          begin = gt;
+        } else {
+          return;
+        }
+      }
+    }
+
+    // calls hit(item, t_max) for each item of a leaf, for cast()
+    template <class hit_t> struct item_hit {
+      const unsigned *items;
+      hit_t *hit;
+
+      bool operator()(unsigned first, unsigned count, float &t_max) {
+        bool result = false;
+        for (unsigned i = 0; i != count; ++i) {
+          result |= (*hit)(items[first + i], t_max);
+        }
+        return result;
+      }
+    };
+
+    // entry distance of the segment into a node, or false if it misses before t_max
+    static bool hits(const node &n, const float *start, const float *rdist, float t_max, float &t_enter) {
+      float t0 = 0, t1 = t_max;
+      for (unsigned k = 0; k != 3; ++k) {
+        float ta = (n.min[k] - start[k]) * rdist[k];
+        float tb = (n.max[k] - start[k]) * rdist[k];
+        if (ta > tb) { float tmp = ta; ta = tb; tb = tmp; }
+        t0 = ta > t0 ? ta : t0;
+        t1 = tb < t1 ? tb : t1;
+      }
+      t_enter = t0;
+      return t0 <= t1;
+    }
+
+  public:
+    bvh() {
+    }
+
+    void reset() {
+      nodes.reset();
+      items.reset();
+    }
+
+    bool is_empty() const {
+      return nodes.size() == 0;
+    }
+
+    unsigned get_num_nodes() const {
+      return nodes.size();
+    }
+
+    const node &get_node(unsigned i) const {
+      return nodes[i];
+    }
+
+    unsigned get_item(unsigned i) const {
+      return items[i];
+    }
+
+    // the box around everything, or an empty box if there are no items
+    aabb get_bounds() const {
+      if (nodes.size() == 0) return aabb(vec3(0, 0, 0), vec3(0, 0, 0));
+      const node &root = nodes[0];
+      vec3 bmin(root.min[0], root.min[1], root.min[2]);
+      vec3 bmax(root.max[0], root.max[1], root.max[2]);
+      return aabb((bmin + bmax) * 0.5f, (bmax - bmin) * 0.5f);
+    }
+
+    // build the tree for num_boxes items with these boxes. item i is boxes[i].
+    // every item goes in the tree, so leave out any that must never be hit.
+    void build(const aabb *boxes, unsigned num_boxes) {
+      nodes.resize(0);
+      items.resize(num_boxes);
+      if (!num_boxes) return;
+
+      dynarray<centre> centres(num_boxes);
+      for (unsigned i = 0; i != num_boxes; ++i) {
+        vec3 c = boxes[i].get_center();
+        centres[i].v[0] = c.x(); centres[i].v[1] = c.y(); centres[i].v[2] = c.z();
+        items[i] = i;
+      }
+
+      // (node, begin, end) still to build
+      struct task { unsigned index, begin, end; };
+      task stack[max_depth];
+      unsigned sp = 0;
+
+      nodes.resize(1);
+      stack[sp].index = 0; stack[sp].begin = 0; stack[sp].end = num_boxes; sp++;
+
+      while (sp) {
+        task t = stack[--sp];
+
+        // bounds of the boxes and of their centres
+        float bmin[3] = { 1e30f, 1e30f, 1e30f }, bmax[3] = { -1e30f, -1e30f, -1e30f };
+        float cmin[3] = { 1e30f, 1e30f, 1e30f }, cmax[3] = { -1e30f, -1e30f, -1e30f };
+        for (unsigned i = t.begin; i != t.end; ++i) {
+          const aabb &bb = boxes[items[i]];
+          vec3 lo = bb.get_min(), hi = bb.get_max();
+          const float *c = centres[items[i]].v;
+          for (unsigned k = 0; k != 3; ++k) {
+            bmin[k] = lo[k] < bmin[k] ? lo[k] : bmin[k];
+            bmax[k] = hi[k] > bmax[k] ? hi[k] : bmax[k];
+            cmin[k] = c[k] < cmin[k] ? c[k] : cmin[k];
+            cmax[k] = c[k] > cmax[k] ? c[k] : cmax[k];
+          }
+        }
+
+        node &n = nodes[t.index];
+        for (unsigned k = 0; k != 3; ++k) {
+          n.min[k] = bmin[k];
+          n.max[k] = bmax[k];
+        }
+
+        unsigned count = t.end - t.begin;
+        unsigned axis = 0;
+        for (unsigned k = 1; k != 3; ++k) {
+          if (cmax[k] - cmin[k] > cmax[axis] - cmin[axis]) axis = k;
+        }
+
+        // a leaf if small enough, or if the stack is full
+        if (count <= max_leaf_items || sp + 2 > max_depth) {
+          n.first = t.begin;
+          n.count = count;
+          continue;
+        }
+
+        unsigned mid = t.begin + count / 2;
+        select(items.data(), centres.data(), axis, t.begin, mid, t.end);
+
+        unsigned child = nodes.size();
+        n.first = child;
+        n.count = 0;
+        nodes.resize(child + 2);
+
+        stack[sp].index = child; stack[sp].begin = t.begin; stack[sp].end = mid; sp++;
+        stack[sp].index = child + 1; stack[sp].begin = mid; stack[sp].end = t.end; sp++;
+      }
+    }
+
+    // visit the items near the segment start + t * distance for 0 <= t <= t_max, nearest nodes first.
+    // hit_t has bool operator()(unsigned item, float &t_max). returns true if anything was hit.
+    template <class hit_t> bool cast(const vec3 &start, const vec3 &distance, float &t_max, hit_t &hit) const {
+      item_hit<hit_t> leaf_hit;
+      leaf_hit.items = items.data();
+      leaf_hit.hit = &hit;
+      return cast_leaves(start, distance, t_max, leaf_hit);
+    }
+
+    // as cast, but visit whole leaves.
+    // hit_t has bool operator()(unsigned first, unsigned count, float &t_max) for the items
+    // get_item(first) ... get_item(first + count - 1).
+    template <class hit_t> bool cast_leaves(const vec3 &start, const vec3 &distance, float &t_max, hit_t &hit) const {
+      if (nodes.size() == 0) return false;
+
+      float s[3] = { start.x(), start.y(), start.z() };
+      float rdist[3];
+      for (unsigned k = 0; k != 3; ++k) {
+        rdist[k] = distance[k] != 0 ? 1.0f / distance[k] : 1e30f;
+      }
+
+      struct entry { unsigned index; float t; };
+      entry stack[max_depth + 1];
+      unsigned sp = 0;
+      float t_enter;
+      if (!hits(nodes[0], s, rdist, t_max, t_enter)) return false;
+      stack[sp].index = 0; stack[sp].t = t_enter; sp++;
+
+      bool result = false;
+      while (sp) {
+        entry e = stack[--sp];
+        if (e.t > t_max) continue;
+
+        const node &n = nodes[e.index];
+        if (n.count) {
+          result |= hit(n.first, n.count, t_max);
+        } else {
+          float ta, tb;
+          bool hit_a = hits(nodes[n.first], s, rdist, t_max, ta);
+          bool hit_b = hits(nodes[n.first + 1], s, rdist, t_max, tb);
+          unsigned near_index = n.first, far_index = n.first + 1;
+          if (hit_a && hit_b && tb < ta) {
+            unsigned tmp = near_index; near_index = far_index; far_index = tmp;
+            float tt = ta; ta = tb; tb = tt;
+          } else if (!hit_a) {
+            near_index = far_index; ta = tb;
+            hit_a = hit_b; hit_b = false;
+          }
+
+          // push the far one first so that the near one comes off the stack first
+          if (hit_b) { stack[sp].index = far_index; stack[sp].t = tb; sp++; }
+          if (hit_a) { stack[sp].index = near_index; stack[sp].t = ta; sp++; }
+        }
+      }
+      return result;
+    }
+  };
+}
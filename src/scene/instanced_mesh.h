@@ -0,0 +1,266 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// many copies of one mesh drawn with one call
+//
+
+namespace octet {
+  /*
+   * instanced_mesh - draws a mesh many times, each instance with its own
+   * instance-to-model matrix and two vec4s of parameters.
+   *
+   * With ES3 instancing the instances go in a second vertex buffer read with
+   * glVertexAttribDivisor and are drawn with glDrawElementsInstanced.
+   * Without it, the instances are baked into one big mesh on the CPU, which
+   * costs memory and a rebuild on every change but is still a single draw.
+   *
+   * The shader sees the same attributes either way:
+   *   instanceToModel (attribute_instance_matrix), instanceParams (attribute_instance_params)
+   *   and color (attribute_color).
+   */
+  class instanced_mesh {
+    struct instance {
+      mat4t instanceToModel;
+      vec4 params;
+      vec4 color;
+    };
+
+    // the mesh to copy, not owned. needs pos, normal and tangent as floats.
+    mesh *source;
+
+    dynarray<instance> instances;
+
+    // per-instance vertex buffer for the instanced path
+    ref<gl_resource> instance_buffer;
+
+    // all instances transformed into one mesh for the fallback path
+    mesh merged;
+
+    // true if instances have changed since the last upload
+    bool dirty;
+
+    bool use_instancing;
+
+    void upload_instances() {
+      unsigned bytes = instances.size() * sizeof(instance);
+      if (instance_buffer->get_size() != bytes) {
+        instance_buffer->allocate(GL_ARRAY_BUFFER, bytes);
+      }
+      if (bytes) {
+        instance_buffer->assign(instances.data(), 0, bytes);
+      }
+    }
+
+    // pre-transform every instance into one vertex buffer.
+    // normals and tangents are rotated here, so the shader sees an identity instanceToModel.
+    void merge_instances() {
+      enum { stride = 68 };
+      unsigned nv = source->get_num_vertices();
+      unsigned ni = source->get_num_indices();
+      unsigned num_instances = instances.size();
+
+      merged.init();
+      merged.allocate(nv * num_instances * stride, ni * num_instances * sizeof(uint32_t));
+      merged.set_params(stride, ni * num_instances, nv * num_instances, source->get_mode(), GL_UNSIGNED_INT);
+      merged.add_attribute(attribute_pos, 3, GL_FLOAT, 0);
+      merged.add_attribute(attribute_normal, 3, GL_FLOAT, 12);
+      merged.add_attribute(attribute_tangent, 3, GL_FLOAT, 24);
+      merged.add_attribute(attribute_instance_params, 4, GL_FLOAT, 36);
+      merged.add_attribute(attribute_color, 4, GL_FLOAT, 52);
+      if (!num_instances) return;
+
+      unsigned src_stride = source->get_stride();
+      unsigned pos_offset = source->get_offset(source->get_slot(attribute_pos));
+      unsigned normal_offset = source->get_offset(source->get_slot(attribute_normal));
+      unsigned tangent_offset = source->get_offset(source->get_slot(attribute_tangent));
+
+      {
+        gl_resource::rolock src_vtx(source->get_vertices());
+        gl_resource::rwlock dest_vtx(merged.get_vertices());
+        float *dest = dest_vtx.f32();
+        for (unsigned i = 0; i != num_instances; ++i) {
+          const instance &inst = instances[i];
+          const mat4t &m = inst.instanceToModel;
+          const uint8_t *src = src_vtx.u8();
+          for (unsigned j = 0; j != nv; ++j, src += src_stride, dest += stride / sizeof(float)) {
+            const float *p = (const float*)(src + pos_offset);
+            const float *n = (const float*)(src + normal_offset);
+            const float *t = (const float*)(src + tangent_offset);
+            vec4 wp = vec4(p[0], p[1], p[2], 1) * m;
+            vec4 wn = (vec4(n[0], n[1], n[2], 0) * m).normalize();
+            vec4 wt = (vec4(t[0], t[1], t[2], 0) * m).normalize();
+            dest[0] = wp[0]; dest[1] = wp[1]; dest[2] = wp[2];
+            dest[3] = wn[0]; dest[4] = wn[1]; dest[5] = wn[2];
+            dest[6] = wt[0]; dest[7] = wt[1]; dest[8] = wt[2];
+            memcpy(dest + 9, inst.params.get(), sizeof(float) * 4);
+            memcpy(dest + 13, inst.color.get(), sizeof(float) * 4);
+          }
+        }
+      }
+
+      {
+        gl_resource::rolock src_idx(source->get_indices());
+        gl_resource::rwlock dest_idx(merged.get_indices());
+        uint32_t *dest = dest_idx.u32();
+        bool is_short = source->get_index_type() == GL_UNSIGNED_SHORT;
+        for (unsigned i = 0; i != num_instances; ++i) {
+          unsigned base = i * nv;
+          for (unsigned j = 0; j != ni; ++j) {
+            *dest++ = base + (is_short ? src_idx.u16()[j] : src_idx.u32()[j]);
+          }
+        }
+      }
+    }
+
+    void render_instanced() {
+    #ifndef __APPLE__
+      source->enable_attributes();
+
+      instance_buffer->bind();
+      for (unsigned i = 0; i != 4; ++i) {
+        unsigned attr = attribute_instance_matrix + i;
+        glVertexAttribPointer(attr, 4, GL_FLOAT, GL_FALSE, sizeof(instance), (void*)(i * sizeof(vec4)));
+        glEnableVertexAttribArray(attr);
+        glVertexAttribDivisor(attr, 1);
+      }
+      glVertexAttribPointer(attribute_instance_params, 4, GL_FLOAT, GL_FALSE, sizeof(instance), (void*)(4 * sizeof(vec4)));
+      glEnableVertexAttribArray(attribute_instance_params);
+      glVertexAttribDivisor(attribute_instance_params, 1);
+      glVertexAttribPointer(attribute_color, 4, GL_FLOAT, GL_FALSE, sizeof(instance), (void*)(5 * sizeof(vec4)));
+      glEnableVertexAttribArray(attribute_color);
+      glVertexAttribDivisor(attribute_color, 1);
+
+      source->get_indices()->bind();
+      glDrawElementsInstanced(source->get_mode(), source->get_num_indices(), source->get_index_type(), (GLvoid*)0, instances.size());
+
+      // divisors are sticky, so put them back for the next mesh
+      static const unsigned attrs[6] = {
+        attribute_instance_matrix + 0, attribute_instance_matrix + 1, attribute_instance_matrix + 2, attribute_instance_matrix + 3,
+        attribute_instance_params, attribute_color
+      };
+      for (unsigned i = 0; i != 6; ++i) {
+        unsigned attr = attrs[i];
+        glVertexAttribDivisor(attr, 0);
+        glDisableVertexAttribArray(attr);
+      }
+      source->disable_attributes();
+    #endif
+    }
+
+    void render_merged() {
+      // the merged vertices are already in model space
+      glVertexAttrib4f(attribute_instance_matrix + 0, 1, 0, 0, 0);
+      glVertexAttrib4f(attribute_instance_matrix + 1, 0, 1, 0, 0);
+      glVertexAttrib4f(attribute_instance_matrix + 2, 0, 0, 1, 0);
+      glVertexAttrib4f(attribute_instance_matrix + 3, 0, 0, 0, 1);
+      merged.render();
+    }
+
+  public:
+    instanced_mesh() {
+      source = 0;
+      dirty = true;
+      use_instancing = false;
+    }
+
+    // true if this context can draw with glDrawElementsInstanced and glVertexAttribDivisor
+    static bool can_instance() {
+    #if defined(WIN32)
+      // the function pointers are null if the driver does not provide them (see init_wgl)
+      return glDrawElementsInstanced != 0 && glVertexAttribDivisor != 0;
+    #elif defined(__APPLE__)
+      // the GLUT context is legacy OpenGL, without the ES3 entry points
+      return false;
+    #else
+      return true;
+    #endif
+    }
+
+    void init(mesh *source, bool allow_instancing = true) {
+      this->source = source;
+      instance_buffer = new gl_resource();
+      instances.reset();
+      use_instancing = allow_instancing && can_instance();
+      dirty = true;
+    }
+
+    // switch between the instanced path and the merged fallback
+    void set_use_instancing(bool value) {
+      value = value && can_instance();
+      if (value != use_instancing) {
+        use_instancing = value;
+        dirty = true;
+      }
+    }
+
+    bool get_use_instancing() const {
+      return use_instancing;
+    }
+
+    void clear() {
+      instances.reset();
+      dirty = true;
+    }
+
+    unsigned add_instance(const mat4t &instanceToModel, const vec4 &params, const vec4 &color) {
+      instance inst;
+      inst.instanceToModel = instanceToModel;
+      inst.params = params;
+      inst.color = color;
+      instances.push_back(inst);
+      dirty = true;
+      return instances.size() - 1;
+    }
+
+    void set_instance(unsigned index, const mat4t &instanceToModel, const vec4 &params, const vec4 &color) {
+      instance &inst = instances[index];
+      inst.instanceToModel = instanceToModel;
+      inst.params = params;
+      inst.color = color;
+      dirty = true;
+    }
+
+    unsigned get_num_instances() const {
+      return instances.size();
+    }
+
+    // bounding box of all the instances in model space
+    aabb get_aabb() const {
+      if (!source || !instances.size()) return aabb();
+      aabb result = source->get_aabb().get_transform(instances[0].instanceToModel);
+      for (unsigned i = 1; i != instances.size(); ++i) {
+        result = result.get_union(source->get_aabb().get_transform(instances[i].instanceToModel));
+      }
+      return result;
+    }
+
+    // number of triangles drawn by render()
+    unsigned get_num_triangles() const {
+      return source ? source->get_num_indices() / 3 * instances.size() : 0;
+    }
+
+    // draw all the instances.
+    // assume the shader, uniforms and render params are already set up.
+    void render() {
+      if (!source || !instances.size()) return;
+
+      if (dirty) {
+        if (use_instancing) {
+          upload_instances();
+        } else {
+          merge_instances();
+        }
+        dirty = false;
+      }
+
+      if (use_instancing) {
+        render_instanced();
+      } else {
+        render_merged();
+      }
+    }
+  };
+}
@@ -0,0 +1,86 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// a mesh with several levels of detail in one index buffer
+//
+
+namespace octet {
+  /*
+   * lod_mesh - one vertex buffer shared by several levels of detail, each drawn from
+   * its own range of the index buffer. Level 0 is the finest.
+   *
+   * Build the levels with a mesh_builder (eg. add_CD_lods) and pass the index ranges
+   * to init. Each level remembers its longest edge, so select_level can pick the
+   * coarsest level that still looks smooth at a given distance.
+   */
+  class lod_mesh {
+    struct level {
+      unsigned first_index;
+      unsigned num_indices;
+      float max_edge;
+    };
+
+    mesh shared;
+    dynarray<level> levels;
+
+  public:
+    lod_mesh() {
+    }
+
+    // level i uses the indices from level_first_index[i] to level_first_index[i+1]
+    void init(mesh_builder &mb, const unsigned *level_first_index, unsigned num_levels) {
+      mb.get_mesh(shared);
+      levels.resize(num_levels);
+      for (unsigned i = 0; i != num_levels; ++i) {
+        level &l = levels[i];
+        l.first_index = level_first_index[i];
+        l.num_indices = level_first_index[i+1] - level_first_index[i];
+        float max_edge2 = 0;
+        for (unsigned j = 0; j + 2 < l.num_indices; j += 3) {
+          for (unsigned k = 0; k != 3; ++k) {
+            const float *a = mb.get_pos(mb.get_index(l.first_index + j + k));
+            const float *b = mb.get_pos(mb.get_index(l.first_index + j + (k + 1) % 3));
+            float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+            max_edge2 = max(max_edge2, dx*dx + dy*dy + dz*dz);
+          }
+        }
+        l.max_edge = sqrtf(max_edge2);
+      }
+    }
+
+    // all levels share this mesh's vertices
+    mesh &get_mesh() {
+      return shared;
+    }
+
+    aabb get_aabb() {
+      return shared.get_aabb();
+    }
+
+    unsigned get_num_levels() const {
+      return levels.size();
+    }
+
+    unsigned get_num_indices(unsigned lod) const {
+      return levels[lod].num_indices;
+    }
+
+    // the coarsest level whose longest edge is at most max_edge_pixels long on screen
+    unsigned select_level(float pixels_per_unit, float max_edge_pixels) const {
+      unsigned lod = 0;
+      while (lod + 1 < levels.size() && levels[lod+1].max_edge * pixels_per_unit <= max_edge_pixels) {
+        ++lod;
+      }
+      return lod;
+    }
+
+    // draw one level. assume the shader and uniforms are already set up.
+    void render(unsigned lod) {
+      if (lod >= levels.size()) return;
+      shared.render(levels[lod].first_index, levels[lod].num_indices);
+    }
+  };
+}
@@ -21,17 +21,6 @@ namespace octet {
     ref<param> bump;
     ref<param> shininess;
 
-    void bind_textures() const {
-      // set textures 0, 1, 2, 3 to their respective values
-      diffuse->render(0, GL_TEXTURE_2D);
-      ambient->render(1, GL_TEXTURE_2D);
-      emission->render(2, GL_TEXTURE_2D);
-      specular->render(3, GL_TEXTURE_2D);
-      bump->render(4, GL_TEXTURE_2D);
-      shininess->render(5, GL_TEXTURE_2D);
-      glActiveTexture(GL_TEXTURE0);
-    }
-
     void init(param *param_) {
       specular = diffuse = ambient = param_;
       emission = new param(vec4(0, 0, 0, 0));
@@ -93,6 +82,18 @@ namespace octet {
       shininess = new param(vec4(30.0f/255, 0, 0, 0));
     }
 
+    // set textures 0-5 to the material's values. the scene skips this when the material has not changed.
+    void bind_textures() const {
+      // set textures 0, 1, 2, 3 to their respective values
+      diffuse->render(0, GL_TEXTURE_2D);
+      ambient->render(1, GL_TEXTURE_2D);
+      emission->render(2, GL_TEXTURE_2D);
+      specular->render(3, GL_TEXTURE_2D);
+      bump->render(4, GL_TEXTURE_2D);
+      shininess->render(5, GL_TEXTURE_2D);
+      glActiveTexture(GL_TEXTURE0);
+    }
+
     void render(bump_shader &shader, const mat4t &modelToProjection, const mat4t &modelToCamera, vec4 *light_uniforms, int num_light_uniforms, int num_lights) const {
       shader.render(modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
       bind_textures();
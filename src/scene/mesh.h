@@ -10,6 +10,13 @@
 namespace octet {
   class mesh : public resource {
   public:
+    // gl calls made by enable_attributes, draw and disable_attributes, see get_stats().
+    // the buffer binds and uploads are counted by gl_resource.
+    struct stats {
+      unsigned attribute_calls;
+      unsigned draws;
+    };
+
     // default vertex format
     // added tangent
     struct vertex {
@@ -41,6 +48,226 @@ namespace octet {
     // bounding box
     aabb mesh_aabb;
 
+    // triangles for ray_cast, built on first use and rebuilt after the mesh changes
+    bvh triangle_bvh;
+    bool triangle_bvh_valid;
+
+    // bumped whenever any mesh's positions or indices change, so caches of world space boxes know to rebuild
+    static unsigned &geometry_version() {
+      static unsigned version;
+      return version;
+    }
+
+    // the positions of four triangles transposed into SSE lanes.
+    // pos[k] is ax, ay, az, bx, by, bz, cx, cy, cz (k = 0 .. 8) of each triangle.
+    struct triangle_packet {
+      vec4 pos[9];
+    };
+
+    // the triangles of each bvh leaf, four to a packet, so that a leaf is a few aligned loads.
+    // the leaf with items first .. first + count - 1 starts at triangle_packets[leaf_packets[first]].
+    dynarray<triangle_packet> triangle_packets;
+    dynarray<unsigned> leaf_packets;
+
+    // the nearest triangle hit by a segment, see ray_cast
+    struct triangle_hit {
+      const uint8_t *vtx;
+      const uint8_t *idx;
+      unsigned stride;
+      unsigned pos_offset;
+      unsigned index_type;
+      vec3 org;
+      vec3 dir;
+
+      int indices[3];
+      vec4 numer;
+      float denom;
+
+      unsigned get_index(unsigned i) const {
+        return index_type == GL_UNSIGNED_INT ? ((const uint32_t*)idx)[i] : ((const uint16_t*)idx)[i];
+      }
+
+      vec3 get_pos(unsigned index) const {
+        const float *p = (const float*)(vtx + pos_offset + stride * index);
+        return vec3(p[0], p[1], p[2]);
+      }
+
+      bool operator()(unsigned tri, float &t_max) {
+        unsigned i0 = get_index(tri * 3 + 0), i1 = get_index(tri * 3 + 1), i2 = get_index(tri * 3 + 2);
+        vec3 a = get_pos(i0) - org;
+        vec3 b = get_pos(i1) - org;
+        vec3 c = get_pos(i2) - org;
+        vec3 d = dir;
+
+        // solve [ba, bb, bc, bd] * [[ax, ay, az, 1], [bx, by, bz, 1], [cx, cy, cz, 1], [-dx, -dy, -dz, 0]] = [0, 0, 0, 1]
+        //
+        // ie. ba + bb + bc = 1  and  ba * a + bb * b + bc * c = bd * d
+        //
+        // [ba, bb, bc] are barycentric coordinates, bd is the distance along the vector
+
+        // The last line of the inverse matrix is the solution (vector triple products)
+        vec4 n(
+          dot(cross(b, c), d),
+          dot(cross(c, a), d),
+          dot(cross(a, b), d),
+          dot(cross(a, b), c)
+        );
+        float den = n[0] + n[1] + n[2];
+
+        // using a multiply lets us check the sign without using a divide.
+        if (den == 0 || !all(n * den >= vec4(0, 0, 0, 0))) return false;
+
+        float t = n[3] / den;
+        if (t > t_max) return false;
+
+        t_max = t;
+        indices[0] = i0;
+        indices[1] = i1;
+        indices[2] = i2;
+        numer = n;
+        denom = den;
+        return true;
+      }
+    };
+
+    // the nearest triangle of a bvh leaf, testing four at a time from triangle_packets.
+    // each lane does the same arithmetic as triangle_hit, so the results are the same.
+    struct triangle_packet_hit {
+      const triangle_packet *packets;
+      const unsigned *leaf_packets;
+      vec4 org[3];
+      vec4 dir[3];
+
+      unsigned item;
+      vec4 numer;
+      float denom;
+
+      // dot(cross(p, q), r) in each lane
+      static vec4 triple(const vec4 *p, const vec4 *q, const vec4 *r) {
+        vec4 x = p[1] * q[2] - p[2] * q[1];
+        vec4 y = p[2] * q[0] - p[0] * q[2];
+        vec4 z = p[0] * q[1] - p[1] * q[0];
+        return x * r[0] + y * r[1] + z * r[2];
+      }
+
+      // items first .. first + count - 1 in packet p, count <= 4
+      bool test4(const triangle_packet &p, unsigned first, unsigned count, float &t_max) {
+        vec4 a[3], b[3], c[3];
+        for (unsigned k = 0; k != 3; ++k) {
+          a[k] = p.pos[k] - org[k];
+          b[k] = p.pos[k + 3] - org[k];
+          c[k] = p.pos[k + 6] - org[k];
+        }
+
+        // see triangle_hit
+        vec4 n0 = triple(b, c, dir);
+        vec4 n1 = triple(c, a, dir);
+        vec4 n2 = triple(a, b, dir);
+        vec4 n3 = triple(a, b, c);
+        vec4 den = n0 + n1 + n2;
+
+        // lanes with den != 0 and n * den >= 0. lanes past count are padding.
+        unsigned mask = (1 << count) - 1;
+        #ifdef OCTET_SSE
+          __m128 zero = _mm_setzero_ps();
+          __m128 ok = _mm_cmpneq_ps(den.get_m(), zero);
+          ok = _mm_and_ps(ok, _mm_cmpge_ps((n0 * den).get_m(), zero));
+          ok = _mm_and_ps(ok, _mm_cmpge_ps((n1 * den).get_m(), zero));
+          ok = _mm_and_ps(ok, _mm_cmpge_ps((n2 * den).get_m(), zero));
+          ok = _mm_and_ps(ok, _mm_cmpge_ps((n3 * den).get_m(), zero));
+          mask &= (unsigned)_mm_movemask_ps(ok);
+        #else
+          for (unsigned j = 0; j != 4; ++j) {
+            float d = den[j];
+            if (d == 0 || !(n0[j] * d >= 0 && n1[j] * d >= 0 && n2[j] * d >= 0 && n3[j] * d >= 0)) {
+              mask &= ~(1 << j);
+            }
+          }
+        #endif
+        if (!mask) return false;
+
+        // in item order, as triangle_hit sees them
+        bool result = false;
+        for (unsigned j = 0; j != count; ++j) {
+          if (!(mask & (1 << j))) continue;
+          float t = n3[j] / den[j];
+          if (t > t_max) continue;
+
+          t_max = t;
+          item = first + j;
+          numer = vec4(n0[j], n1[j], n2[j], n3[j]);
+          denom = den[j];
+          result = true;
+        }
+        return result;
+      }
+
+      // leaves have up to bvh::max_leaf_items triangles, but may have more if the tree is very deep
+      bool operator()(unsigned first, unsigned count, float &t_max) {
+        const triangle_packet *p = packets + leaf_packets[first];
+        bool result = false;
+        for (unsigned i = 0; i < count; i += 4, ++p) {
+          result |= test4(*p, first + i, min(count - i, 4u), t_max);
+        }
+        return result;
+      }
+    };
+
+    // one box per triangle
+    void build_triangle_bvh() {
+      triangle_bvh.reset();
+      triangle_packets.reset();
+      leaf_packets.reset();
+      triangle_bvh_valid = true;
+
+      unsigned pos_slot = get_slot(attribute_pos);
+      if (mode != GL_TRIANGLES || pos_slot == ~0u) return;
+      if (index_type != GL_UNSIGNED_INT && index_type != GL_UNSIGNED_SHORT) return;
+      if (get_size(pos_slot) < 3 || get_kind(pos_slot) != GL_FLOAT) return;
+
+      gl_resource::rolock idx_lock(indices);
+      gl_resource::rolock vtx_lock(vertices);
+      triangle_hit tris;
+      tris.vtx = vtx_lock.u8();
+      tris.idx = idx_lock.u8();
+      tris.stride = stride;
+      tris.pos_offset = get_offset(pos_slot);
+      tris.index_type = index_type;
+
+      unsigned num_triangles = num_indices / 3;
+      dynarray<aabb> boxes(num_triangles);
+      for (unsigned i = 0; i != num_triangles; ++i) {
+        vec3 a = tris.get_pos(tris.get_index(i * 3 + 0));
+        vec3 b = tris.get_pos(tris.get_index(i * 3 + 1));
+        vec3 c = tris.get_pos(tris.get_index(i * 3 + 2));
+        vec3 lo = min(min(a, b), c), hi = max(max(a, b), c);
+        boxes[i] = aabb((lo + hi) * 0.5f, (hi - lo) * 0.5f);
+      }
+      triangle_bvh.build(boxes.data(), num_triangles);
+
+      // transpose the triangles of each leaf into packets for triangle_packet_hit.
+      // short packets repeat the leaf's last triangle.
+      leaf_packets.resize(num_triangles);
+      for (unsigned n = 0; n != triangle_bvh.get_num_nodes(); ++n) {
+        const bvh::node &leaf = triangle_bvh.get_node(n);
+        if (!leaf.count) continue;
+        leaf_packets[leaf.first] = triangle_packets.size();
+        for (unsigned i = 0; i < leaf.count; i += 4) {
+          triangle_packet p;
+          for (unsigned j = 0; j != 4; ++j) {
+            unsigned tri = triangle_bvh.get_item(leaf.first + min(i + j, leaf.count - 1));
+            for (unsigned v = 0; v != 3; ++v) {
+              vec3 pos = tris.get_pos(tris.get_index(tri * 3 + v));
+              for (unsigned k = 0; k != 3; ++k) {
+                p.pos[v * 3 + k][j] = pos[k];
+              }
+            }
+          }
+          triangle_packets.push_back(p);
+        }
+      }
+    }
+
     // add a new edge to a hash map. (index, index) -> (triangle+1, triangle+1)
     static void add_edge(hash_map<uint64_t, uint64_t> &edges, unsigned tri_idx, unsigned i0, unsigned i1) {
       if (i0 == i1) return; // note: (0, 0) means empty
@@ -78,6 +305,106 @@ namespace octet {
       return dot(normal, dir) <= 0;
     }
 
+    // shared by the threads of add_3d_normals
+    struct tangent_context {
+      const uint8_t *indices;
+      unsigned index_type;
+      unsigned num_triangles;
+      unsigned triangles_per_chunk;
+
+      // source positions and uvs
+      const uint8_t *src;
+      unsigned src_stride;
+      unsigned pos_offset;
+      unsigned uv_offset;
+
+      // chunk 0 sums into the new vertices, the others into scratch (six floats per vertex)
+      uint8_t *dest;
+      unsigned dest_stride;
+      unsigned tangent_offset;
+      unsigned bitangent_offset;
+      float *scratch;
+      unsigned num_chunks;
+      unsigned num_vertices;
+      unsigned vertices_per_chunk;
+    };
+
+    static unsigned get_raw_index(const uint8_t *indices, unsigned index_type, unsigned i) {
+      return
+        index_type == GL_UNSIGNED_INT ? ((const uint32_t*)indices)[i] :
+        index_type == GL_UNSIGNED_SHORT ? ((const uint16_t*)indices)[i] :
+        indices[i]
+      ;
+    }
+
+    // sum the unnormalized tangent and bitangent of a range of triangles into their vertices
+    static void add_triangle_tangents(void *context_ptr, unsigned chunk) {
+      const tangent_context &c = *(const tangent_context*)context_ptr;
+      uint8_t *dest = c.dest;
+      unsigned dest_stride = c.dest_stride, tangent_offset = c.tangent_offset, bitangent_offset = c.bitangent_offset;
+      if (chunk != 0) {
+        dest = (uint8_t*)(c.scratch + (chunk - 1) * c.num_vertices * 6);
+        dest_stride = sizeof(float) * 6;
+        tangent_offset = 0;
+        bitangent_offset = sizeof(float) * 3;
+      }
+
+      unsigned first = chunk * c.triangles_per_chunk;
+      unsigned last = min(first + c.triangles_per_chunk, c.num_triangles);
+      for (unsigned tri = first; tri < last; ++tri) {
+        unsigned idx[3];
+        const float *pos[3], *uv[3];
+        for (unsigned j = 0; j != 3; ++j) {
+          idx[j] = get_raw_index(c.indices, c.index_type, tri * 3 + j);
+          const uint8_t *v = c.src + idx[j] * c.src_stride;
+          pos[j] = (const float*)(v + c.pos_offset);
+          uv[j] = (const float*)(v + c.uv_offset);
+        }
+
+        // solve:
+        //   duv1.x() * tangent + duv1.y() * bitangent = dpos1
+        //   duv2.x() * tangent + duv2.y() * bitangent = dpos2
+        // without dividing by the determinant, so larger triangles count for more.
+        float du1 = uv[1][0] - uv[0][0], dv1 = uv[1][1] - uv[0][1];
+        float du2 = uv[2][0] - uv[0][0], dv2 = uv[2][1] - uv[0][1];
+        float tangent[3], bitangent[3];
+        for (unsigned k = 0; k != 3; ++k) {
+          float dpos1 = pos[1][k] - pos[0][k], dpos2 = pos[2][k] - pos[0][k];
+          tangent[k] = dpos1 * dv2 - dpos2 * dv1;
+          bitangent[k] = dpos2 * du1 - dpos1 * du2;
+        }
+
+        for (unsigned j = 0; j != 3; ++j) {
+          float *t = (float*)(dest + idx[j] * dest_stride + tangent_offset);
+          float *b = (float*)(dest + idx[j] * dest_stride + bitangent_offset);
+          t[0] += tangent[0]; t[1] += tangent[1]; t[2] += tangent[2];
+          b[0] += bitangent[0]; b[1] += bitangent[1]; b[2] += bitangent[2];
+        }
+      }
+    }
+
+    // add the other chunks' sums to a range of vertices and normalize them
+    static void normalize_tangents(void *context_ptr, unsigned chunk) {
+      const tangent_context &c = *(const tangent_context*)context_ptr;
+      unsigned first = chunk * c.vertices_per_chunk;
+      unsigned last = min(first + c.vertices_per_chunk, c.num_vertices);
+      for (unsigned i = first; i < last; ++i) {
+        float *t = (float*)(c.dest + i * c.dest_stride + c.tangent_offset);
+        float *b = (float*)(c.dest + i * c.dest_stride + c.bitangent_offset);
+        for (unsigned s = 1; s < c.num_chunks; ++s) {
+          const float *sum = c.scratch + ((s - 1) * c.num_vertices + i) * 6;
+          t[0] += sum[0]; t[1] += sum[1]; t[2] += sum[2];
+          b[0] += sum[3]; b[1] += sum[4]; b[2] += sum[5];
+        }
+        float tlen2 = t[0] * t[0] + t[1] * t[1] + t[2] * t[2];
+        float blen2 = b[0] * b[0] + b[1] * b[1] + b[2] * b[2];
+        float rt = tlen2 > 0 ? 1.0f / sqrtf(tlen2) : 0.0f;
+        float rb = blen2 > 0 ? 1.0f / sqrtf(blen2) : 0.0f;
+        t[0] *= rt; t[1] *= rt; t[2] *= rt;
+        b[0] *= rb; b[1] *= rb; b[2] *= rb;
+      }
+    }
+
   public:
     RESOURCE_META(mesh)
 
@@ -121,6 +448,7 @@ namespace octet {
       mode = GL_TRIANGLES;
 
       mesh_skin = _skin;
+      invalidate_bvh();
     }
 
     void set_default_attributes() {
@@ -195,10 +523,12 @@ namespace octet {
 
     void set_num_vertices(unsigned value) {
       num_vertices = value;
+      invalidate_bvh();
     }
 
     void set_num_indices(unsigned value) {
       num_indices = value;
+      invalidate_bvh();
     }
 
     void set_mode(unsigned value) {
@@ -278,8 +608,9 @@ namespace octet {
       vertices->unlock_read_only();
     }
 
-    // set a vec4 value of an attribute (only when not in a vbo)
+    // set a vec4 value of an attribute. the change is uploaded on the next bind.
     void set_value(unsigned slot, unsigned index, const vec4 &value) {
+      if (get_attr(slot) == attribute_pos) invalidate_bvh();
       if (get_kind(slot) == GL_FLOAT) {
         float *src = (float*)((uint8_t*)vertices->lock() + stride * index + get_offset(slot));
         unsigned size = get_size(slot);
@@ -287,7 +618,7 @@ namespace octet {
         if (size > 1) src[1] = value[1];
         if (size > 2) src[2] = value[2];
         if (size > 3) src[3] = value[3];
-        vertices->unlock();
+        vertices->mark_dirty(stride * index + get_offset(slot), size * sizeof(float));
   	  } else if (get_kind(slot) == GL_UNSIGNED_BYTE) {
         uint8_t *src = (uint8_t*)((uint8_t*)vertices->lock() + stride * index + get_offset(slot));
         unsigned size = get_size(slot);
@@ -295,7 +626,7 @@ namespace octet {
         if (size > 1) src[1] = (uint8_t)( value[1] * 255.0f );
         if (size > 2) src[2] = (uint8_t)( value[2] * 255.0f );
         if (size > 3) src[3] = (uint8_t)( value[3] * 255.0f );
-        vertices->unlock();
+        vertices->mark_dirty(stride * index + get_offset(slot), size);
       }
     }
 
@@ -316,11 +647,13 @@ namespace octet {
     void allocate(unsigned vsize, unsigned isize) {
       vertices->allocate(GL_ARRAY_BUFFER, vsize);
       indices->allocate(GL_ELEMENT_ARRAY_BUFFER, isize);
+      invalidate_bvh();
     }
 
     void assign(unsigned vsize, unsigned isize, uint8_t *vsrc, uint8_t *isrc) {
       vertices->assign(vsrc, 0, vsize);
       indices->assign(isrc, 0, isize);
+      invalidate_bvh();
     }
 
     void set_params(unsigned stride_, unsigned num_indices_, unsigned num_vertices_, unsigned mode_, unsigned index_type_) {
@@ -329,6 +662,31 @@ namespace octet {
       num_vertices = num_vertices_;
       mode = mode_;
       index_type = index_type_;
+      invalidate_bvh();
+    }
+
+    // call this after writing positions or indices through the buffers directly
+    void invalidate_bvh() {
+      triangle_bvh_valid = false;
+      geometry_version()++;
+    }
+
+    // changes whenever the geometry of any mesh changes or an instance gets a new mesh
+    static unsigned get_geometry_version() {
+      return geometry_version();
+    }
+
+    // call this when something that boxes meshes, such as a mesh_instance, changes which mesh it uses
+    static void mark_geometry_changed() {
+      geometry_version()++;
+    }
+
+    // the triangles in a tree for ray_cast. built when first used after the mesh changes.
+    const bvh &get_triangle_bvh() {
+      if (!triangle_bvh_valid) {
+        build_triangle_bvh();
+      }
+      return triangle_bvh;
     }
 
     void dump(FILE *file) {
@@ -366,11 +724,13 @@ namespace octet {
         glEnableVertexAttribArray(attr);
         n >>= 1;
       }
+      get_stats().attribute_calls += get_num_slots() * 2;
     }
 
     void draw() {
       indices->bind();
       glDrawElements(get_mode(), get_num_indices(), get_index_type(), (GLvoid*)0);
+      get_stats().draws++;
     }
 
     void disable_attributes() {
@@ -378,6 +738,7 @@ namespace octet {
         unsigned attr = get_attr(slot);
         glDisableVertexAttribArray(attr);
       }
+      get_stats().attribute_calls += get_num_slots();
     }
 
     void render() {
@@ -386,6 +747,30 @@ namespace octet {
       disable_attributes();
     }
 
+    // draw num_indices indices starting at first_index, eg. one level of detail
+    void draw(unsigned first_index, unsigned num_indices) {
+      unsigned index_size = get_index_type() == GL_UNSIGNED_INT ? 4 : get_index_type() == GL_UNSIGNED_SHORT ? 2 : 1;
+      indices->bind();
+      glDrawElements(get_mode(), num_indices, get_index_type(), (GLvoid*)(first_index * index_size));
+      get_stats().draws++;
+    }
+
+    void render(unsigned first_index, unsigned num_indices) {
+      enable_attributes();
+      draw(first_index, num_indices);
+      disable_attributes();
+    }
+
+    // counters for all meshes
+    static stats &get_stats() {
+      static stats s;
+      return s;
+    }
+
+    static void reset_stats() {
+      memset(&get_stats(), 0, sizeof(stats));
+    }
+
     void make_cube(float size = 1.0f) {
       init();
       mesh_builder b;
@@ -459,102 +844,106 @@ namespace octet {
       set_mode( GL_LINES );
     }
 
-    // make the normal, tangent, bitangent space for each vertex; tangent already included here
-    void add_3d_normals(const mesh &source) {
+    // make the normal, tangent, bitangent space for each vertex.
+    // copies the source vertices with a tangent and bitangent added at the end of each one.
+    // one pass over the triangles and one upload; big meshes are split over the thread_pool.
+    void add_3d_normals(const mesh &source, unsigned num_threads = 0) {
       init();
       if (source.get_mode() != GL_TRIANGLES || source.get_num_indices() % 3 != 0) {
         printf("warning: make_3d_normals expected triangles\n");
         return;
       }
 
-      //s = source.s; 
-
-      // add tangent and bitangent
-      unsigned stride = source.get_stride();
-      unsigned tangent_slot = add_attribute(attribute_tangent, 3, GL_FLOAT, stride);
-      unsigned bitangent_slot = add_attribute(attribute_bitangent, 3, GL_FLOAT, stride + 12);
-
-      unsigned vsize = (stride + 24) * source.get_num_vertices();
-      unsigned isize = source.get_indices()->get_size(); //mesh::kind_size(get_index_type()) * source.get_num_indices();
-      allocate(vsize, isize);
-      set_params(stride + 24, source.get_num_indices(), source.get_num_vertices(), source.get_mode(), source.get_index_type());
-      indices = source.get_indices();
-
       unsigned pos_slot = source.get_slot(attribute_pos);
       unsigned uv_slot = source.get_slot(attribute_uv);
-      //unsigned normal_slot = source.get_slot(attribute_normal);
+      if (
+        pos_slot == ~0u || uv_slot == ~0u ||
+        source.get_kind(pos_slot) != GL_FLOAT || source.get_size(pos_slot) < 3 ||
+        source.get_kind(uv_slot) != GL_FLOAT || source.get_size(uv_slot) < 2
+      ) {
+        printf("warning: make_3d_normals expected float positions and uvs\n");
+        return;
+      }
+
+      // the offset field of the format has six bits
+      unsigned src_stride = source.get_stride();
+      unsigned new_stride = src_stride + 24;
+      if (src_stride + 12 > 0x3f) {
+        printf("warning: make_3d_normals vertices too big\n");
+        return;
+      }
 
+      // keep the source attributes, except any old tangents
       for (unsigned slot = 0; slot != source.get_num_slots(); ++slot) {
-        for (unsigned i = 0; i != source.get_num_vertices(); ++i) {
-          vec4 value = source.get_value(slot, i);
-          set_value(slot, i, value);
+        unsigned attr = source.get_attr(slot);
+        if (attr != attribute_tangent && attr != attribute_bitangent) {
+          format[num_slots] = source.format[slot];
+          if (source.normalized & (1 << slot)) normalized |= 1 << num_slots;
+          num_slots++;
         }
       }
+      add_attribute(attribute_tangent, 3, GL_FLOAT, src_stride);
+      add_attribute(attribute_bitangent, 3, GL_FLOAT, src_stride + 12);
 
-      for (unsigned i = 0; i != source.get_num_vertices(); ++i) {
-        vec4 value(0, 0, 0, 0);
-        set_value(tangent_slot, i, value);
-        set_value(bitangent_slot, i, value);
-      }
-
-      for (unsigned i = 0; i != source.get_num_indices(); i += 3) {
-        unsigned idx[3] = {
-          source.get_index(i),
-          source.get_index(i+1),
-          source.get_index(i+2)
-        };
-        vec4 uv0 = source.get_value(uv_slot, idx[0]);
-        vec4 uv1 = source.get_value(uv_slot, idx[1]);
-        vec4 uv2 = source.get_value(uv_slot, idx[2]);
-        vec4 pos0 = source.get_value(pos_slot, idx[0]);
-        vec4 pos1 = source.get_value(pos_slot, idx[1]);
-        vec4 pos2 = source.get_value(pos_slot, idx[2]);
-        vec4 duv1 = uv1 - uv0;
-        vec4 duv2 = uv2 - uv0;
-        vec4 dpos1 = pos1 - pos0;
-        vec4 dpos2 = pos2 - pos0;
-
-        // solve:
-        //   duv1.x() * tangent + duv1.y() * bitangent = dpos1
-        //   duv2.x() * tangent + duv2.y() * bitangent = dpos2
-
-        //float rdet = 1.0f / (duv1.x() * duv2.y() - duv1.y() * duv2.x());
-        float rdet = 1.0f;
-        vec4 tangent = (dpos1 * duv2.y() - dpos2 * duv1.y()) * rdet;
-        vec4 bitangent = (dpos2 * duv1.x() - dpos1 * duv2.x()) * rdet;
-
-        /*vec4 normal = source.get_value(normal_slot, idx[0]);
-        printf("normal=%s\n", normal.toString());
-        printf("tangent=%s\n", tangent.toString());
-        printf("bitangent=%s\n", bitangent.toString());
-        printf("duv1.x() * tangent + duv1.y() * bitangent=%s\n", (tangent * duv1.x() + bitangent * duv1.y()).toString());
-        printf("dpos1=%s\n", dpos1.toString());
-        printf("duv2.x() * tangent + duv2.y() * bitangent=%s\n", (tangent * duv2.x() + bitangent * duv2.y()).toString());
-        printf("dpos2=%s\n", dpos2.toString());*/
-
-        for (unsigned j = 0; j != 3; ++j) {
-          vec4 new_tangent = tangent + get_value(tangent_slot, idx[j]);
-          vec4 new_bitangent = bitangent + get_value(bitangent_slot, idx[j]);
-          set_value(tangent_slot, idx[j], new_tangent);
-          set_value(bitangent_slot, idx[j], new_bitangent);
-        }
+      unsigned nv = source.get_num_vertices();
+      unsigned ntris = source.get_num_indices() / 3;
+      vertices->allocate(GL_ARRAY_BUFFER, new_stride * nv);
+      set_params(new_stride, source.get_num_indices(), nv, source.get_mode(), source.get_index_type());
+      indices = source.get_indices();
+      mesh_skin = source.mesh_skin;
+      mesh_aabb = source.mesh_aabb;
+      if (!nv) return;
+
+      // one thread per 16k triangles, each summing into its own copy of the tangents
+      enum { triangles_per_thread = 0x4000, vertices_per_chunk = 0x1000 };
+      unsigned num_chunks = num_threads ? num_threads : thread_pool::get_num_cpus();
+      num_chunks = max(min(num_chunks, ntris / triangles_per_thread), 1u);
+      dynarray<float> scratch;
+      if (num_chunks > 1) {
+        scratch.resize((num_chunks - 1) * nv * 6);
+        memset(scratch.data(), 0, scratch.size() * sizeof(float));
       }
 
-      // normalize
-      for (unsigned i = 0; i != source.get_num_vertices(); ++i) {
-        vec3 new_tangent = get_value(tangent_slot, i).xyz().normalize();
-        vec3 new_bitangent = get_value(bitangent_slot, i).xyz().normalize();
-        set_value(tangent_slot, i, vec4(new_tangent,0));
-        set_value(bitangent_slot, i, vec4(new_bitangent,0));
+      gl_resource::rolock src_vtx(source.get_vertices());
+      gl_resource::rolock src_idx(source.get_indices());
+      gl_resource::rwlock dest_vtx(vertices);
+      uint8_t *dest = dest_vtx.u8();
+      const uint8_t *src = src_vtx.u8();
+      for (unsigned i = 0; i != nv; ++i) {
+        memcpy(dest + i * new_stride, src + i * src_stride, src_stride);
+        memset(dest + i * new_stride + src_stride, 0, 24);
       }
+
+      tangent_context c;
+      c.indices = src_idx.u8();
+      c.index_type = source.get_index_type();
+      c.num_triangles = ntris;
+      c.triangles_per_chunk = (ntris + num_chunks - 1) / num_chunks;
+      c.src = src;
+      c.src_stride = src_stride;
+      c.pos_offset = source.get_offset(pos_slot);
+      c.uv_offset = source.get_offset(uv_slot);
+      c.dest = dest;
+      c.dest_stride = new_stride;
+      c.tangent_offset = src_stride;
+      c.bitangent_offset = src_stride + 12;
+      c.scratch = scratch.data();
+      c.num_chunks = num_chunks;
+      c.num_vertices = nv;
+      c.vertices_per_chunk = vertices_per_chunk;
+
+      thread_pool::for_each(num_chunks, add_triangle_tangents, &c, num_chunks);
+      unsigned num_vertex_chunks = (nv + vertices_per_chunk - 1) / vertices_per_chunk;
+      thread_pool::for_each(num_vertex_chunks, normalize_tangents, &c, num_chunks);
     }
 
-    // apply a matrix to every position
+    // apply a matrix to every position, with one upload at the end
     void transform(unsigned attr, mat4t &matrix) {
       if (get_num_vertices() == 0) {
         return;
       }
 
+      gl_resource::batch edit(vertices);
       unsigned slot = get_slot(attr);
       for (unsigned i = 0; i != get_num_vertices(); ++i) {
         vec4 pos = get_value(slot, i);
@@ -563,89 +952,75 @@ namespace octet {
       }
     }
 
-    // *very* slow ray cast.
+    // ray cast through the triangle bvh (see get_triangle_bvh), testing the triangles of each leaf four at a time.
+    // finds the nearest triangle hit by start + t * distance, 0 <= t <= t_max, and reduces t_max to its t.
     // returns "barycentric" coordinates.
-    // eg. hit pos = bary[0] * pos0 + bary[1] * pos1 + bary[2] * pos2 (or ray.start + ray.distance * bary[3])
+    // eg. hit pos = bary[0] * pos0 + bary[1] * pos1 + bary[2] * pos2 (or start + distance * bary[3])
     // eg. hit uv = bary[0] * uv0 + bary[1] * uv1 + bary[2] * uv2
-    bool ray_cast(const ray &the_ray, int indices[], vec4 &bary_numer, float &bary_denom) {
-      unsigned pos_slot = get_slot(attribute_pos);
-      if (get_index_type() != GL_UNSIGNED_INT) return false;
-      if (get_size(pos_slot) < 3) return false;
-      if (get_kind(pos_slot) != GL_FLOAT) return false;
+    bool ray_cast(const vec3 &start, const vec3 &distance, float &t_max, int indices[], vec4 &bary_numer, float &bary_denom) {
+      const bvh &tree = get_triangle_bvh();
+      triangle_packet_hit hit;
+      hit.packets = triangle_packets.data();
+      hit.leaf_packets = leaf_packets.data();
+      for (unsigned k = 0; k != 3; ++k) {
+        hit.org[k] = vec4(start[k]);
+        hit.dir[k] = vec4(distance[k]);
+      }
 
-      vec3 org = the_ray.get_start();
-      vec3 dir = the_ray.get_distance();
-      //app_utils::log("ray_cast: org=%s dir=%s\n", org.toString(), dir.toString());
+      if (tree.is_empty() || !tree.cast_leaves(start, distance, t_max, hit)) {
+        bary_numer = vec4(0, 0, 0, 0);
+        bary_denom = 0;
+        return false;
+      }
 
-      unsigned pos_offset = get_offset(pos_slot);
       gl_resource::rolock idx_lock(get_indices());
-      gl_resource::rolock vtx_lock(get_vertices());
-      const uint32_t *idx = idx_lock.u32();
-      const uint8_t *vtx = vtx_lock.u8();
-
-      float best_denom = 0;
-      vec4 best_numer(0, 0, 0, 0);
-      for (unsigned i = 0; i != get_num_indices(); i += 3) {
-        vec3 a = *(const vec3*)(vtx + pos_offset + stride * idx[i+0]) - org;
-        vec3 b = *(const vec3*)(vtx + pos_offset + stride * idx[i+1]) - org;
-        vec3 c = *(const vec3*)(vtx + pos_offset + stride * idx[i+2]) - org;
-        vec3 d = dir;
-
-        // solve [ba, bb, bc, bd] * [[ax, ay, az, 1], [bx, by, bz, 1], [cx, cy, cz, 1], [-dx, -dy, -dz, 0]] = [0, 0, 0, 1]
-        //
-        // ie. ba + bb + bc = 1  and  ba * a + bb * b + bc * c = bd * d
-        //
-        // [ba, bb, bc] are barycentric coordinates, bd is the distance along the vector
-
-        // The last line of the inverse matrix is the solution (vector triple products)
-
-        // numerator
-        vec4 numer(
-          dot(cross(b, c), d),
-          dot(cross(c, a), d),
-          dot(cross(a, b), d),
-          dot(cross(a, b), c)
-        );
-
-        // denominator
-        float denom = numer[0] + numer[1] + numer[2];
-
-        //app_utils::log("a=%s b=%s c=%s d=%s denom=%f\n", a.toString(), b.toString(), c.toString(), d.toString(), denom);
-        //app_utils::log("numer=%s\n", numer.toString());
-        //app_utils::log("res=%s\n", (numer / denom).toString());
-
-        // using a multiply lets us check the sign without using a divide.
-        vec4 bary2 = numer * denom;
-
-        if (all(bary2 >= vec4(0, 0, 0, 0))) {
-          rational best_distance(best_numer[3], best_denom);
-          rational new_distance(numer[3], denom);
-          /*printf(
-            "t%d %9.3f %d %d %d  %s %s %s\n",
-            i, numer[3]/denom, idx[i+0], idx[i+1], idx[i+2],
-            (numer/denom).toString(), best_distance.toString(), new_distance.toString()
-          );*/
-
-          unsigned further = new_distance > best_distance;
-          if (!further) {
-            indices[0] = idx[i+0];
-            indices[1] = idx[i+1];
-            indices[2] = idx[i+2];
-            best_numer = numer;
-            best_denom = denom;
-          }
-        }
+      triangle_hit tris;
+      tris.idx = idx_lock.u8();
+      tris.index_type = index_type;
+      unsigned tri = tree.get_item(hit.item);
+      for (unsigned v = 0; v != 3; ++v) {
+        indices[v] = tris.get_index(tri * 3 + v);
       }
+      bary_numer = hit.numer;
+      bary_denom = hit.denom;
+      return true;
+    }
 
-      if (fabsf(best_denom) < 1e-6f) {
+    // as ray_cast, but testing one triangle at a time from the vertex buffer.
+    // gives the same results; kept as a reference for the packet version.
+    bool ray_cast_scalar(const vec3 &start, const vec3 &distance, float &t_max, int indices[], vec4 &bary_numer, float &bary_denom) {
+      const bvh &tree = get_triangle_bvh();
+      if (tree.is_empty()) return false;
+
+      gl_resource::rolock idx_lock(get_indices());
+      gl_resource::rolock vtx_lock(get_vertices());
+      triangle_hit hit;
+      hit.vtx = vtx_lock.u8();
+      hit.idx = idx_lock.u8();
+      hit.stride = stride;
+      hit.pos_offset = get_offset(get_slot(attribute_pos));
+      hit.index_type = index_type;
+      hit.org = start;
+      hit.dir = distance;
+
+      if (!tree.cast(start, distance, t_max, hit)) {
         bary_numer = vec4(0, 0, 0, 0);
         bary_denom = 0;
         return false;
-      } else {
-        bary_numer = best_numer;
-        bary_denom = best_denom;
-        return true;
       }
+
+      indices[0] = hit.indices[0];
+      indices[1] = hit.indices[1];
+      indices[2] = hit.indices[2];
+      bary_numer = hit.numer;
+      bary_denom = hit.denom;
+      return true;
+    }
+
+    // ray cast along the whole of the_ray
+    bool ray_cast(const ray &the_ray, int indices[], vec4 &bary_numer, float &bary_denom) {
+      float t_max = 1.0f;
+      return ray_cast(the_ray.get_start(), the_ray.get_distance(), t_max, indices, bary_numer, bary_denom);
     }
 
     // access the vbo or memory buffer
@@ -661,11 +1036,13 @@ namespace octet {
     // access the vbo or memory buffer
     void set_vertices(gl_resource *value) {
       vertices = value;
+      invalidate_bvh();
     }
 
     // access the index buffer or memory buffer
     void set_indices(gl_resource *value) {
       indices = value;
+      invalidate_bvh();
     }
 
     // get all the edges in a hash map
@@ -104,6 +104,7 @@ namespace octet {
 
       get_vertices()->unlock();
       get_indices()->unlock();
+      invalidate_bvh();
       set_num_indices(6 * 6);
       set_num_vertices(4 * 6);
       dump(app_utils::log("box\n"));
@@ -105,8 +105,8 @@ namespace octet {
     skeleton *get_skeleton() const { return skel; }
     unsigned get_flags() const { return flags; }
 
-    void set_node(scene_node *value) { node = value; }
-    void set_mesh(mesh *value) { msh = value; }
+    void set_node(scene_node *value) { node = value; mesh::mark_geometry_changed(); }
+    void set_mesh(mesh *value) { msh = value; mesh::mark_geometry_changed(); }
     void set_material(material *value) { mat = value; }
     void set_skeleton(skeleton *value) { skel = value; }
     void set_flags(unsigned value) { flags = value; }
@@ -53,6 +53,7 @@ namespace octet {
 
       get_vertices()->unlock();
       get_indices()->unlock();
+      invalidate_bvh();
       set_num_indices(num_quads * 6);
       set_num_vertices(num_quads * 4);
     }
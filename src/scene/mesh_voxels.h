@@ -65,6 +65,7 @@ namespace octet {
 
       get_vertices()->unlock();
       get_indices()->unlock();
+      invalidate_bvh();
       //dump(app_utils::log("voxels\n"));
     }
 
@@ -0,0 +1,140 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// draws sorted to minimise state changes
+//
+
+namespace octet {
+  /*
+   * render_queue - a list of draws sorted by a 64 bit key.
+   *
+   * The key is, from the top bit down: shader, material, mesh, depth. After sort(), draws
+   * that share a shader and material are next to each other, and within those, draws of the
+   * same mesh, nearest first. The renderer then only binds textures and vertex attributes
+   * when they change.
+   *
+   * Materials and meshes get small ids in the order they are first added each frame.
+   * If there are too many for their bits, the ids wrap; the order is then less good
+   * but the draws are still all there.
+   */
+  class render_queue {
+  public:
+    struct item {
+      uint64_t key;
+      unsigned index;
+    };
+
+  private:
+    enum {
+      depth_bits = 24,
+      mesh_bits = 19,
+      material_bits = 20,
+      mesh_shift = depth_bits,
+      material_shift = mesh_shift + mesh_bits,
+      shader_shift = material_shift + material_bits
+    };
+
+    dynarray<item> items;
+    dynarray<item> scratch;
+
+    hash_map<void *, unsigned> material_ids;
+    hash_map<void *, unsigned> mesh_ids;
+    unsigned num_materials;
+    unsigned num_meshes;
+
+    static unsigned get_id(hash_map<void *, unsigned> &ids, unsigned &count, void *ptr) {
+      if (!ptr) return 0;
+      unsigned &id = ids[ptr];
+      if (!id) id = ++count;
+      return id;
+    }
+
+    // positive floats sort like their bits; keep the top 24 below the sign bit
+    static uint64_t get_depth_key(float depth) {
+      union { float f; uint32_t u; } bits;
+      bits.f = depth > 0 ? depth : 0.0f;
+      return bits.u >> (31 - depth_bits);
+    }
+
+  public:
+    render_queue() {
+      num_materials = num_meshes = 0;
+    }
+
+    // start a new frame
+    void reset() {
+      items.resize(0);
+      material_ids.clear();
+      mesh_ids.clear();
+      num_materials = num_meshes = 0;
+    }
+
+    // add a draw. index is returned by operator[] after sorting, eg. the mesh instance number.
+    // shader is a small number (0 or 1), depth is the distance in front of the camera.
+    void add(unsigned shader, void *mat, void *msh, float depth, unsigned index) {
+      uint64_t material_id = get_id(material_ids, num_materials, mat) & ((1 << material_bits) - 1);
+      uint64_t mesh_id = get_id(mesh_ids, num_meshes, msh) & ((1 << mesh_bits) - 1);
+      item it;
+      it.key =
+        ((uint64_t)shader << shader_shift) |
+        (material_id << material_shift) |
+        (mesh_id << mesh_shift) |
+        get_depth_key(depth)
+      ;
+      it.index = index;
+      items.push_back(it);
+    }
+
+    // stable radix sort on the key, eight bits at a time.
+    // bytes that are the same in every key (eg. the shader byte in most scenes) are skipped.
+    void sort() {
+      unsigned num_items = items.size();
+      if (num_items < 2) return;
+
+      unsigned counts[8][256];
+      memset(counts, 0, sizeof(counts));
+      for (unsigned i = 0; i != num_items; ++i) {
+        uint64_t key = items[i].key;
+        for (unsigned b = 0; b != 8; ++b) {
+          counts[b][(key >> (b * 8)) & 0xff]++;
+        }
+      }
+
+      scratch.resize(num_items);
+      item *src = items.data();
+      item *dest = scratch.data();
+      for (unsigned b = 0; b != 8; ++b) {
+        unsigned *count = counts[b];
+        unsigned first_byte = (unsigned)(src[0].key >> (b * 8)) & 0xff;
+        if (count[first_byte] == num_items) continue;
+
+        unsigned offset = 0;
+        for (unsigned i = 0; i != 256; ++i) {
+          unsigned n = count[i];
+          count[i] = offset;
+          offset += n;
+        }
+        for (unsigned i = 0; i != num_items; ++i) {
+          unsigned byte = (unsigned)(src[i].key >> (b * 8)) & 0xff;
+          dest[count[byte]++] = src[i];
+        }
+        item *tmp = src; src = dest; dest = tmp;
+      }
+
+      if (src != items.data()) {
+        memcpy(items.data(), src, num_items * sizeof(item));
+      }
+    }
+
+    unsigned size() const {
+      return items.size();
+    }
+
+    const item &operator[](unsigned i) const {
+      return items[i];
+    }
+  };
+}
@@ -42,6 +42,34 @@ namespace octet {
 
     int frame_number;
 
+    // every node in the scene, parents before children, for update_transforms
+    dynarray<scene_node*> flat_nodes;
+    dynarray<int> flat_parents;
+    unsigned flat_version;
+
+    // frustum culling: world boxes of the mesh instances and which ones are on the screen
+    bool frustum_culling;
+    dynarray<aabb> world_aabbs;
+    dynarray<uint8_t> instance_visible;
+    unsigned num_drawn;
+    unsigned num_culled;
+
+    // visible instances sorted by shader, material, mesh and depth
+    bool sort_draws;
+    render_queue queue;
+    unsigned num_material_changes;
+    unsigned num_mesh_changes;
+
+    // ray casts: a bvh over the instances' world boxes, with their inverse matrices
+    bvh instance_bvh;
+    dynarray<mat4t> instance_worldToNode;
+    // the mesh instance index of each item in instance_bvh. instances that can not be hit are left out.
+    dynarray<unsigned> instance_bvh_items;
+    unsigned instance_bvh_hierarchy_version;
+    unsigned instance_bvh_transform_version;
+    unsigned instance_bvh_geometry_version;
+    unsigned instance_bvh_num_instances;
+
     void draw_aabb(const aabb &bb) {
       vec3 pos[8];
       for (int i = 0; i != 8; ++i) {
@@ -96,7 +124,7 @@ namespace octet {
       for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
         mesh_instance *mi = mesh_instances[mesh_index];
         aabb bb = mi->get_mesh()->get_aabb();
-        bb = bb.get_transform(mi->get_node()->calcModelToWorld());
+        bb = bb.get_transform(mi->get_node()->get_nodeToWorld());
         draw_aabb(bb);
       }
     }
@@ -114,7 +142,7 @@ namespace octet {
       for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
         mesh_instance *mi = mesh_instances[mesh_index];
         mesh *msh = mi->get_mesh();
-        mat4t modelToWorld = mi->get_node()->calcModelToWorld();
+        mat4t modelToWorld = mi->get_node()->get_nodeToWorld();
         mat4t modelToCamera;
         mat4t modelToProjection;
         cam.get_matrices(modelToProjection, modelToCamera, modelToWorld);
@@ -169,8 +197,51 @@ namespace octet {
       }
     }
 
+    // find which mesh instances may be on the screen. call after cam.set_cameraToWorld.
+    // skinned meshes move outside their bind pose box and boxes that were never set are empty,
+    // so those are always drawn.
+    void cull_instances(camera_instance &cam) {
+      unsigned num_instances = mesh_instances.size();
+      instance_visible.resize(num_instances);
+      world_aabbs.resize(num_instances);
+      for (unsigned i = 0; i != num_instances; ++i) {
+        mesh_instance *mi = mesh_instances[i];
+        world_aabbs[i] = mi->get_mesh()->get_aabb().get_transform(mi->get_node()->get_nodeToWorld());
+      }
+
+      if (!frustum_culling) {
+        memset(instance_visible.data(), 1, num_instances);
+        num_drawn = num_instances;
+        num_culled = 0;
+        return;
+      }
+
+      mat4t worldToProjection;
+      mat4t worldToCamera;
+      mat4t worldToWorld;
+      worldToWorld.loadIdentity();
+      cam.get_matrices(worldToProjection, worldToCamera, worldToWorld);
+      frustum view(worldToProjection);
+      view.cull(world_aabbs.data(), num_instances, instance_visible.data());
+
+      num_drawn = 0;
+      for (unsigned i = 0; i != num_instances; ++i) {
+        mesh_instance *mi = mesh_instances[i];
+        mesh *msh = mi->get_mesh();
+        vec3 half = msh->get_aabb().get_half_extent();
+        bool no_box = half.x() == 0 && half.y() == 0 && half.z() == 0;
+        if (no_box || (msh->get_skin() && mi->get_skeleton())) {
+          instance_visible[i] = 1;
+        }
+        num_drawn += instance_visible[i];
+      }
+      num_culled = num_instances - num_drawn;
+    }
+
     void render_impl(bump_shader &object_shader, bump_shader &skin_shader, camera_instance &cam, float aspect_ratio) {
-      mat4t cameraToWorld = cam.get_node()->calcModelToWorld();
+      update_transforms();
+
+      const mat4t &cameraToWorld = cam.get_node()->get_nodeToWorld();
 
       mat4t worldToCamera;
       cameraToWorld.invertQuick(worldToCamera);
@@ -182,14 +253,32 @@ namespace octet {
 
       draw_debug_data(object_shader, cam);
 
+      cull_instances(cam);
+
+      // sort the visible instances so that textures and vertex attributes are set only on change.
+      // unsorted, the queue keeps the order they were added.
+      queue.reset();
       for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
+        if (!instance_visible[mesh_index]) continue;
         mesh_instance *mi = mesh_instances[mesh_index];
         mesh *msh = mi->get_mesh();
+        unsigned shader = msh->get_skin() && mi->get_skeleton() ? 1 : 0;
+        float depth = sort_draws ? -(world_aabbs[mesh_index].get_center().xyz1() * worldToCamera).z() : 0.0f;
+        queue.add(shader, sort_draws ? mi->get_material() : 0, sort_draws ? msh : 0, depth, mesh_index);
+      }
+      if (sort_draws) queue.sort();
+
+      material *bound_mat = 0;
+      mesh *bound_msh = 0;
+      num_material_changes = num_mesh_changes = 0;
+      for (unsigned q = 0; q != queue.size(); ++q) {
+        mesh_instance *mi = mesh_instances[queue[q].index];
+        mesh *msh = mi->get_mesh();
         skin *skn = msh->get_skin();
         skeleton *skel = mi->get_skeleton();
         material *mat = mi->get_material();
 
-        mat4t modelToWorld = mi->get_node()->calcModelToWorld();
+        const mat4t &modelToWorld = mi->get_node()->get_nodeToWorld();
         mat4t modelToCamera;
         mat4t modelToProjection;
         cam.get_matrices(modelToProjection, modelToCamera, modelToWorld);
@@ -198,7 +287,7 @@ namespace octet {
           // normal rendering for single matrix objects
           // build a projection matrix: model -> world -> camera_instance -> projection
           // the projection space is the cube -1 <= x/w, y/w, z/w <= 1
-          mat->render(object_shader, modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
+          object_shader.render(modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
         } else {
           // multi-matrix rendering
           mat4t *transforms = skel->calc_transforms(modelToCamera, skn);
@@ -208,20 +297,38 @@ namespace octet {
             //glGetIntegerv(GL_MAX_VERTEX_UNIFORM_VECTORS, &mvuv);
             printf("warning: too many bones (%d/%d)\n", num_bones, mvuv/4);
           } else {
-            mat->render_skinned(skin_shader, cameraToProjection, transforms, num_bones, light_uniforms, num_light_uniforms, num_lights);
+            skin_shader.render_skinned(cameraToProjection, transforms, num_bones, light_uniforms, num_light_uniforms, num_lights);
           }
         }
 
-        msh->enable_attributes();
+        // the texture units are shared by both shaders
+        if (mat != bound_mat) {
+          mat->bind_textures();
+          bound_mat = mat;
+          num_material_changes++;
+        }
+
+        if (msh != bound_msh) {
+          if (bound_msh) bound_msh->disable_attributes();
+          msh->enable_attributes();
+          bound_msh = msh;
+          num_mesh_changes++;
+        }
         msh->draw();
-        msh->disable_attributes();
 
         if (mi->get_flags() & mesh_instance::flag_selected) {
+          // draw_aabb uses its own vertex attributes
+          bound_msh->disable_attributes();
+          bound_msh = 0;
           aabb bb = mi->get_mesh()->get_aabb();
-          bb = bb.get_transform(mi->get_node()->calcModelToWorld());
+          bb = bb.get_transform(modelToWorld);
           draw_aabb(bb);
         }
       }
+
+      if (bound_msh) {
+        bound_msh->disable_attributes();
+      }
       frame_number++;
     }
   public:
@@ -240,6 +347,13 @@ namespace octet {
       assert(is_power_of_two(debug_line_buffer.size()));
       memset(&debug_line_buffer[0], 0, debug_line_buffer.size() * sizeof(debug_line_buffer[0]));
       debug_in_ptr = 0;
+      flat_version = ~0u;
+      frustum_culling = true;
+      num_drawn = num_culled = 0;
+      sort_draws = true;
+      num_material_changes = num_mesh_changes = 0;
+      instance_bvh_hierarchy_version = instance_bvh_transform_version = instance_bvh_geometry_version = ~0u;
+      instance_bvh_num_instances = 0;
     }
 
     void visit(visitor &v) {
@@ -352,6 +466,37 @@ namespace octet {
       render_debug_lines = value;
     }
 
+    // skip mesh instances whose bounding boxes are outside the camera's view (on by default)
+    void set_frustum_culling(bool value) {
+      frustum_culling = value;
+    }
+
+    // draw mesh instances grouped by shader, material and mesh, nearest first (on by default).
+    // when off, they are drawn in the order they were added.
+    void set_sort_draws(bool value) {
+      sort_draws = value;
+    }
+
+    // times the last render bound a material's textures
+    unsigned get_num_material_changes() const {
+      return num_material_changes;
+    }
+
+    // times the last render set up a mesh's vertex attributes
+    unsigned get_num_mesh_changes() const {
+      return num_mesh_changes;
+    }
+
+    // mesh instances drawn by the last render
+    unsigned get_num_drawn() const {
+      return num_drawn;
+    }
+
+    // mesh instances skipped by the last render because they were off the screen
+    unsigned get_num_culled() const {
+      return num_culled;
+    }
+
     // debugging aid to log vertices
     void set_dump_vertices(bool value) {
       dump_vertices = value;
@@ -386,6 +531,18 @@ namespace octet {
       }
     }
 
+    // recalculate the world matrices of nodes that have moved, parents first.
+    // render does this; call it after moving nodes to use the matrices before rendering.
+    void update_transforms() {
+      if (flat_version != scene_node::get_hierarchy_version()) {
+        flat_nodes.resize(0);
+        flat_parents.resize(0);
+        get_all_child_nodes(flat_nodes, flat_parents);
+        flat_version = scene_node::get_hierarchy_version();
+      }
+      scene_node::update_nodeToWorld(flat_nodes.data(), flat_nodes.size());
+    }
+
     // call OpenGL to draw all the mesh instances (scene_node + mesh + material)
     void render(bump_shader &object_shader, bump_shader &skin_shader, camera_instance &cam, float aspect_ratio) {
       render_impl(object_shader, skin_shader, cam, aspect_ratio);
@@ -421,7 +578,7 @@ namespace octet {
       for (int i = 0; i != mesh_instances.size(); ++i) {
         mesh_instance *mi = mesh_instances[i];
         if (mi && mi->get_node()) {
-          mat4t nodeToWorld = mi->get_node()->calcModelToWorld();
+          const mat4t &nodeToWorld = mi->get_node()->get_nodeToWorld();
           aabb bb = mi->get_mesh()->get_aabb();
           bb = bb.get_transform(nodeToWorld);
           if (first) {
@@ -438,38 +595,138 @@ namespace octet {
     struct cast_result {
       mesh_instance *mi;
       rational depth;
+
+      // world position of the hit and the vertices of the triangle
+      vec3 pos;
+      int indices[3];
     };
 
-    // brute force & ignorance ray cast.
-    // return the mesh instance and location of hits.
-    // todo: build a kd tree for mesh instance bbs & mesh triangles
-    void cast_ray(cast_result &result, const ray &the_ray) {
+  private:
+    // tests the instances in a leaf of instance_bvh
+    struct instance_hit {
+      scene *the_scene;
+      vec3 start;
+      vec3 end;
+      cast_result *result;
+
+      bool operator()(unsigned item, float &t_max) {
+        unsigned i = the_scene->instance_bvh_items[item];
+        mesh_instance *mi = the_scene->mesh_instances[i];
+        if (!mi || !mi->get_mesh()) return false;
+
+        // t is the same in model space because the transform is affine
+        const mat4t &worldToNode = the_scene->instance_worldToNode[i];
+        vec3 model_start = (start.xyz1() * worldToNode).xyz();
+        vec3 model_end = (end.xyz1() * worldToNode).xyz();
+        vec4 bary_numer;
+        float bary_denom;
+        if (!mi->get_mesh()->ray_cast(model_start, model_end - model_start, t_max, result->indices, bary_numer, bary_denom)) {
+          return false;
+        }
+        result->mi = mi;
+        result->depth = rational(t_max);
+        result->pos = start + (end - start) * t_max;
+        return true;
+      }
+    };
+
+    struct cast_rays_context {
+      scene *the_scene;
+      cast_result *results;
+      const ray *rays;
+      unsigned num_rays;
+    };
+
+    enum { rays_per_task = 64 };
+
+    static void cast_rays_task(void *context_ptr, unsigned task) {
+      const cast_rays_context &c = *(const cast_rays_context*)context_ptr;
+      unsigned end = min((task + 1) * rays_per_task, c.num_rays);
+      for (unsigned i = task * rays_per_task; i < end; ++i) {
+        c.the_scene->cast_prepared_ray(c.results[i], c.rays[i]);
+      }
+    }
+
+    // cast_ray after prepare_ray_casts. only reads the scene, so several can run at once.
+    void cast_prepared_ray(cast_result &result, const ray &the_ray) {
       result.mi = 0;
       result.depth = rational(0, 0);
+      result.pos = vec3(0, 0, 0);
+      result.indices[0] = result.indices[1] = result.indices[2] = 0;
 
-      for (int i = 0; i != mesh_instances.size(); ++i) {
+      instance_hit hit;
+      hit.the_scene = this;
+      hit.start = the_ray.get_start();
+      hit.end = the_ray.get_end();
+      hit.result = &result;
+      float t_max = 1.0f;
+      instance_bvh.cast(hit.start, hit.end - hit.start, t_max, hit);
+    }
+
+  public:
+    // bring the instance bvh and the meshes' triangle bvhs up to date.
+    // cast_ray does this; the instance bvh is only rebuilt when something has moved or a mesh has changed.
+    void prepare_ray_casts() {
+      update_transforms();
+
+      unsigned num_instances = mesh_instances.size();
+      if (
+        instance_bvh_hierarchy_version == scene_node::get_hierarchy_version() &&
+        instance_bvh_transform_version == scene_node::get_transform_version() &&
+        instance_bvh_geometry_version == mesh::get_geometry_version() &&
+        instance_bvh_num_instances == num_instances
+      ) {
+        return;
+      }
+
+      // use the triangles' bounds as the mesh aabb may not have been set
+      dynarray<aabb> boxes;
+      instance_bvh_items.resize(0);
+      instance_worldToNode.resize(num_instances);
+      for (unsigned i = 0; i != num_instances; ++i) {
         mesh_instance *mi = mesh_instances[i];
-        if (mi && mi->get_node()) {
-          mat4t nodeToWorld = mi->get_node()->calcModelToWorld();
-          mesh *mesh = mi->get_mesh();
-          aabb bb = mesh->get_aabb();
-          bb = bb.get_transform(nodeToWorld);
-          if (the_ray.intersects(bb)) {
-            mat4t worldToNode = nodeToWorld.inverse3x4();
-            //ray model_ray = ray(vec3(0, 0, -1), vec3(0, 0, 2)); //the_ray.get_transform(worldToNode);
-            ray model_ray = the_ray.get_transform(worldToNode);
-            int indices[3] = {0};
-            vec4 bary_numer(0, 0, 0, 0);
-            float bary_denom;
-            bool hit = mesh->ray_cast(model_ray, indices, bary_numer, bary_denom);
-            if (hit) {
-              rational depth(bary_numer.w() / bary_denom);
-              result.depth = min(depth, result.depth);
-            }
-            //printf("hit=%d %s %f\n", hit, (bary_numer/bary_denom).toString(tmp, sizeof(tmp)), (float)result.depth);
-          }
+        if (!mi || !mi->get_node() || !mi->get_mesh() || mi->get_mesh()->get_triangle_bvh().is_empty()) {
+          // nothing to hit; leave it out of the tree
+          instance_worldToNode[i].loadIdentity();
+          continue;
         }
+        const mat4t &nodeToWorld = mi->get_node()->get_nodeToWorld();
+        boxes.push_back(mi->get_mesh()->get_triangle_bvh().get_bounds().get_transform(nodeToWorld));
+        instance_bvh_items.push_back(i);
+        instance_worldToNode[i] = nodeToWorld.inverse3x4();
+      }
+      instance_bvh.build(boxes.data(), boxes.size());
+
+      instance_bvh_hierarchy_version = scene_node::get_hierarchy_version();
+      instance_bvh_transform_version = scene_node::get_transform_version();
+      instance_bvh_geometry_version = mesh::get_geometry_version();
+      instance_bvh_num_instances = num_instances;
+    }
+
+    // find the nearest mesh instance hit by the_ray, and where.
+    // a bvh over the instances finds the ones near the ray and a bvh per mesh finds the triangles.
+    // result.mi is null if nothing was hit.
+    void cast_ray(cast_result &result, const ray &the_ray) {
+      prepare_ray_casts();
+      cast_prepared_ray(result, the_ray);
+    }
+
+    // cast many rays at once, spread over up to num_threads threads (0 = one per cpu).
+    void cast_rays(cast_result *results, const ray *rays, unsigned num_rays, unsigned num_threads = 0) {
+      prepare_ray_casts();
+
+      // the threads must not build mesh bvhs, so build any that an edit has invalidated
+      for (unsigned i = 0; i != mesh_instances.size(); ++i) {
+        mesh_instance *mi = mesh_instances[i];
+        if (mi && mi->get_mesh()) mi->get_mesh()->get_triangle_bvh();
       }
+
+      cast_rays_context c;
+      c.the_scene = this;
+      c.results = results;
+      c.rays = rays;
+      c.num_rays = num_rays;
+      thread_pool::for_each((num_rays + rays_per_task - 1) / rays_per_task, cast_rays_task, &c, num_threads);
     }
 
     // add a new line in world space (old ones will be lost)
@@ -21,17 +21,51 @@ namespace octet {
 
     // sid used to target animations
     atom_t sid;
+
+    // cached product of nodeToParent and all the parents' nodeToParent.
+    // if a node is dirty, so are all of its children.
+    mat4t nodeToWorld;
+    bool world_dirty;
+
+    // bumped whenever any node gets a new child, so flattened hierarchies know to rebuild
+    static unsigned &hierarchy_version() {
+      static unsigned version;
+      return version;
+    }
+
+    // bumped whenever any node moves, so caches of world space boxes know to rebuild
+    static unsigned &transform_version() {
+      static unsigned version;
+      return version;
+    }
+
+    // this node and everything under it need a new nodeToWorld
+    void mark_world_dirty() {
+      if (world_dirty) return;
+      world_dirty = true;
+      transform_version()++;
+      for (int i = 0; i != children.size(); ++i) {
+        children[i]->mark_world_dirty();
+      }
+    }
+
+    void update_nodeToWorld() {
+      nodeToWorld = parent ? nodeToParent * parent->get_nodeToWorld() : nodeToParent;
+      world_dirty = false;
+    }
   public:
     RESOURCE_META(scene_node)
 
     scene_node() {
       nodeToParent.loadIdentity();
       sid = atom_;
+      world_dirty = true;
     }
 
     scene_node(const mat4t &nodeToParent, atom_t sid) {
       this->nodeToParent = nodeToParent;
       this->sid = sid;
+      world_dirty = true;
     }
 
     // the virtual add_ref on animation_target gets passed to here and we pass iton (delegate it) to the resource
@@ -48,6 +82,7 @@ namespace octet {
     void set_value(atom_t sid, atom_t sub_target, atom_t component, float *value) {
       if (sub_target == atom_transform) {
         nodeToParent.init_transpose(value);
+        mark_world_dirty();
       }
     }
 
@@ -62,11 +97,16 @@ namespace octet {
       app_utils::log("visit scene_node nodeToParent\n");
       v.visit(nodeToParent, atom_nodeToParent);
       v.visit(sid, atom_sid);
+      world_dirty = true;
+      hierarchy_version()++;
     }
 
     void add_child(scene_node *new_node) {
       new_node->parent = this;
       children.push_back(new_node);
+      new_node->world_dirty = false;
+      new_node->mark_world_dirty();
+      hierarchy_version()++;
     }
 
     scene_node *get_parent() {
@@ -81,20 +121,48 @@ namespace octet {
       return children[index];
     }
 
+    // the scene_node to world matrix, only recalculated when this node or a parent has moved.
+    const mat4t &get_nodeToWorld() {
+      if (world_dirty) {
+        update_nodeToWorld();
+      }
+      return nodeToWorld;
+    }
+
     // compute the scene_node to world matrix for an individual scene_node;
     mat4t calcModelToWorld() {
-      mat4t result = nodeToParent;
-      for (scene_node *p = parent; p != NULL; p = p->parent) {
-        result = result * p->nodeToParent;
+      return get_nodeToWorld();
+    }
+
+    // bring nodeToWorld up to date for a list of nodes where parents come before their children,
+    // eg. from get_all_child_nodes. each dirty node costs one matrix multiply.
+    static void update_nodeToWorld(scene_node **nodes, unsigned num_nodes) {
+      for (unsigned i = 0; i != num_nodes; ++i) {
+        scene_node *node = nodes[i];
+        if (node->world_dirty) {
+          node->update_nodeToWorld();
+        }
       }
-      return result;
+    }
+
+    // changes with every new child anywhere in any hierarchy
+    static unsigned get_hierarchy_version() {
+      return hierarchy_version();
+    }
+
+    // changes whenever any node is moved
+    static unsigned get_transform_version() {
+      return transform_version();
     }
 
     const mat4t &get_nodeToParent() const {
       return nodeToParent;
     }
 
+    // marks the node as moved. write through the reference straight away;
+    // call this again for changes made later (eg. after rendering).
     mat4t &access_nodeToParent() {
+      mark_world_dirty();
       return nodeToParent;
     }
 
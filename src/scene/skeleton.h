@@ -64,7 +64,7 @@ namespace octet {
 
       // todo: optionally drive animation directly to the skeleton.
       for (int i = 0; i != nodes.size(); ++i) {
-        nodeToParents[i] = nodes[i]->access_nodeToParent();
+        nodeToParents[i] = nodes[i]->get_nodeToParent();
       }
 
       // compute matrix heirachy
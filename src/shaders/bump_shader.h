@@ -168,15 +168,15 @@ namespace octet {
       shader::render();
 
       // customize the program with uniforms
-      glUniformMatrix4fv(modelToProjection_index, 1, GL_FALSE, modelToProjection.get());
-      glUniformMatrix4fv(modelToCamera_index, 1, GL_FALSE, modelToCamera.get());
+      set_uniform(modelToProjection_index, modelToProjection);
+      set_uniform(modelToCamera_index, modelToCamera);
 
-      glUniform4fv(light_uniforms_index, num_light_uniforms, (float*)light_uniforms);
-      glUniform1i(num_lights_index, num_lights);
+      set_uniform(light_uniforms_index, light_uniforms, num_light_uniforms);
+      set_uniform(num_lights_index, num_lights);
 
       // we use textures 0-3 for material properties.
       static const GLint samplers[] = { 0, 1, 2, 3, 4, 5 };
-      glUniform1iv(samplers_index, 6, samplers);
+      set_uniform(samplers_index, samplers, 6);
     }
 
     void render_skinned(const mat4t &cameraToProjection, const mat4t *modelToCamera, int num_matrices, const vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
@@ -184,15 +184,15 @@ namespace octet {
       shader::render();
 
       // customize the program with uniforms
-      glUniformMatrix4fv(cameraToProjection_index, 1, GL_FALSE, cameraToProjection.get());
-      glUniformMatrix4fv(modelToCamera_index, num_matrices, GL_FALSE, (float*)modelToCamera);
+      set_uniform(cameraToProjection_index, cameraToProjection);
+      set_uniform(modelToCamera_index, modelToCamera, num_matrices);
 
-      glUniform4fv(light_uniforms_index, num_light_uniforms, (float*)light_uniforms);
-      glUniform1i(num_lights_index, num_lights);
+      set_uniform(light_uniforms_index, light_uniforms, num_light_uniforms);
+      set_uniform(num_lights_index, num_lights);
 
       // we use textures 0-3 for material properties.
       static const GLint samplers[] = { 0, 1, 2, 3, 4 };
-      glUniform1iv(samplers_index, 5, samplers);
+      set_uniform(samplers_index, samplers, 5);
     }
   };
 }
@@ -49,8 +49,8 @@ namespace octet {
       shader::render();
 
       // set the uniforms.
-      glUniform4fv(emissive_colorIndex_, 1, emissive_color.get());
-      glUniformMatrix4fv(modelToProjectionIndex_, 1, GL_FALSE, modelToProjection.get());
+      set_uniform(emissive_colorIndex_, emissive_color);
+      set_uniform(modelToProjectionIndex_, modelToProjection);
 
       // now we are ready to define the attributes and draw the triangles.
     }
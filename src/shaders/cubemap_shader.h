@@ -8,6 +8,138 @@
 
 namespace octet {
 
+  // One lobe of the piecewise gaussian fit to the CIE 1931 colour matching functions
+  // (Wyman, Sloan and Shirley 2013). Mirrored by lobe() in the spectral GLSL.
+  inline float get_cie_lobe(float nm, float mu, float sigma_below, float sigma_above) {
+    float t = (nm - mu) / (nm < mu ? sigma_below : sigma_above);
+    return expf(-0.5f * t * t);
+  }
+
+  // linear RGB of one nanometre wide light of wavelength nm, before scaling by SPECTRAL_SCALE.
+  inline vec3 get_wavelength_rgb(float nm) {
+    float x = 1.056f * get_cie_lobe(nm, 599.8f, 37.9f, 31.0f) + 0.362f * get_cie_lobe(nm, 442.0f, 16.0f, 26.7f) - 0.065f * get_cie_lobe(nm, 501.1f, 20.4f, 26.2f);
+    float y = 0.821f * get_cie_lobe(nm, 568.8f, 46.9f, 40.5f) + 0.286f * get_cie_lobe(nm, 530.9f, 16.3f, 31.1f);
+    float z = 1.217f * get_cie_lobe(nm, 437.0f, 11.8f, 36.0f) + 0.681f * get_cie_lobe(nm, 459.0f, 26.0f, 13.8f);
+    vec3 rgb(
+      3.2406f * x - 1.5372f * y - 0.4986f * z,
+      -0.9689f * x + 1.8758f * y + 0.0415f * z,
+      0.0557f * x - 0.2040f * y + 1.0570f * z
+    );
+    return max(rgb, vec3(0, 0, 0));
+  }
+
+  // Build the GLSL function "vec3 diffraction_color(float u)" used by the diffraction shaders.
+  // num_orders is the number of diffraction orders summed (the original shader uses 7).
+  //
+  // The original shader maps the order n peak to y = 2 * u / n - 1 and colours it with three
+  // overlapping blend3 bumps, blue at y = 0.25, green at 0.5 and red at 0.75.
+  // If num_wavelengths is not zero, y is instead a wavelength from 400nm (y = 0) to 700nm (y = 1),
+  // split into that many bins. The peak lands between two bins and takes the CIE colour of each
+  // bin's wavelength in proportion. The colours are scaled so that each channel integrates over
+  // the spectrum to the same total as its blend3 bump, so the two modes are equally bright.
+  inline void get_diffraction_glsl(string &result, int num_orders, int num_wavelengths) {
+    const char blend3_source[] = SHADER_STR(
+      vec3 blend3(vec3 x) {
+        vec3 y = 1.0 - x*x;
+        y = max(y, vec3(0, 0, 0));
+        return (y);
+      }
+    );
+
+    const char orders_source[] = SHADER_STR(
+      vec3 diffraction_color(float u) {
+        vec3 cdiff = vec3(0.0, 0.0, 0.0);
+        for (int n = 1; n <= NUM_ORDERS; n++) {
+          float y = 2.0 * u / float(n) - 1.0;
+          cdiff += blend3(vec3(4.0 * (y - 0.75), 4.0 * (y - 0.5), 4.0 * (y - 0.25)));
+        }
+        return cdiff;
+      }
+    );
+
+    // see get_wavelength_rgb
+    const char spectral_source[] = SHADER_STR(
+      float lobe(float nm, float mu, float sigma_below, float sigma_above) {
+        float t = (nm - mu) / (nm < mu ? sigma_below : sigma_above);
+        return exp(-0.5 * t * t);
+      }
+
+      vec3 wavelength_rgb(float nm) {
+        float x = 1.056 * lobe(nm, 599.8, 37.9, 31.0) + 0.362 * lobe(nm, 442.0, 16.0, 26.7) - 0.065 * lobe(nm, 501.1, 20.4, 26.2);
+        float y = 0.821 * lobe(nm, 568.8, 46.9, 40.5) + 0.286 * lobe(nm, 530.9, 16.3, 31.1);
+        float z = 1.217 * lobe(nm, 437.0, 11.8, 36.0) + 0.681 * lobe(nm, 459.0, 26.0, 13.8);
+        vec3 rgb = vec3(
+          3.2406 * x - 1.5372 * y - 0.4986 * z,
+          -0.9689 * x + 1.8758 * y + 0.0415 * z,
+          0.0557 * x - 0.2040 * y + 1.0570 * z
+        );
+        return max(rgb, vec3(0.0, 0.0, 0.0)) * SPECTRAL_SCALE;
+      }
+
+      // the colour of bin k, or black outside the spectrum
+      vec3 bin_rgb(float k) {
+        if (k < 0.0 || k >= float(NUM_WAVELENGTHS)) return vec3(0.0, 0.0, 0.0);
+        return wavelength_rgb(400.0 + 300.0 * (k + 0.5) / float(NUM_WAVELENGTHS));
+      }
+
+      vec3 diffraction_color(float u) {
+        vec3 cdiff = vec3(0.0, 0.0, 0.0);
+        for (int n = 1; n <= NUM_ORDERS; n++) {
+          float y = 2.0 * u / float(n) - 1.0;
+          float bin = y * float(NUM_WAVELENGTHS) - 0.5;
+          float k = floor(bin);
+          float f = bin - k;
+          cdiff += bin_rgb(k) * (1.0 - f) + bin_rgb(k + 1.0) * f;
+        }
+        return cdiff;
+      }
+    );
+
+    char defines[256];
+    if (num_wavelengths) {
+      // each bin is 1 / num_wavelengths wide in y; each blend3 bump integrates to 1 / 3
+      vec3 total(0, 0, 0);
+      for (int k = 0; k != num_wavelengths; ++k) {
+        total += get_wavelength_rgb(400.0f + 300.0f * (k + 0.5f) / num_wavelengths);
+      }
+      vec3 scale(0, 0, 0);
+      for (int c = 0; c != 3; ++c) {
+        scale[c] = total[c] > 0 ? num_wavelengths / 3.0f / total[c] : 0.0f;
+      }
+      snprintf(
+        defines, sizeof(defines), "#define NUM_ORDERS %d\n#define NUM_WAVELENGTHS %d\n#define SPECTRAL_SCALE vec3(%f, %f, %f)\n",
+        num_orders, num_wavelengths, scale.x(), scale.y(), scale.z()
+      );
+    } else {
+      snprintf(defines, sizeof(defines), "#define NUM_ORDERS %d\n", num_orders);
+    }
+    result = defines;
+    if (num_wavelengths) {
+      result += spectral_source;
+    } else {
+      result += blend3_source;
+      result += orders_source;
+    }
+  }
+
+  // Build the GLSL function "vec4 reflection_color(samplerCube cubemap, vec3 dir, float r)" used by
+  // the diffraction shaders. It reads the cube map level prefiltered for a lobe 1 / r radians
+  // wide (see cubemap_prefilter). The level goes in as a bias, as GLSL ES fragment shaders
+  // can not set it directly, so it is exact where the reflection is magnified.
+  inline void get_reflection_glsl(string &result) {
+    const char reflection_source[] = SHADER_STR(
+      vec4 reflection_color(samplerCube cubemap, vec3 dir, float r) {
+        float lod = max(log2(LOD_SCALE / r), 0.0);
+        return textureCube(cubemap, dir, lod);
+      }
+    );
+
+    char defines[64];
+    snprintf(defines, sizeof(defines), "#define LOD_SCALE %.3f\n", cubemap_prefilter::get_lod_scale());
+    result += defines;
+    result += reflection_source;
+  }
+
   /* cubemap_fragdiffraction_shader - This is a variation of cubemap_diffraction_shader
    * that does the calculations in the fragment shader, so it does not depend of the
    * level of detail of the mesh.
@@ -28,7 +160,8 @@ namespace octet {
     GLuint samplerIndex_;
 
   public:
-    void init() {
+    // num_orders and num_wavelengths select the variant, see get_diffraction_glsl.
+    void init(int num_orders = 7, int num_wavelengths = 0) {
       // this is the vertex shader.
       // it is called for each corner of each triangle
       // it inputs pos and uv from each corner
@@ -74,12 +207,6 @@ namespace octet {
         uniform vec4 hiliteColor;
         uniform vec3 lightPosition;
         uniform vec3 cameraPosition;
-        
-        vec3 blend3(vec3 x){
-          vec3 y = 1.0 - x*x;
-          y = max(y, vec3(0, 0, 0));
-          return (y);
-        }
 
         void main() {
           vec3 P = position_;
@@ -96,22 +223,22 @@ namespace octet {
           
           if (u < 0.0) u = -u;
 
-          vec4 cdiff = vec4(0.0, 0.0, 0.0, 1.0);
-
-          for (int n = 1; n < 8; n++) {
-            float y = 2.0 * u / float(n) - 1.0;
-            cdiff.xyz += blend3(vec3(4.0 * (y - 0.75), 4.0 * (y - 0.5), 4.0 * (y - 0.25)));
-          }
+          vec4 cdiff = vec4(diffraction_color(u), 1.0);
 
-          vec4 cubemapColor = textureCube(sampler, reflect(vec3(V.x, -V.y, V.z), N));
+          vec4 cubemapColor = reflection_color(sampler, reflect(vec3(V.x, -V.y, V.z), N), r);
 
           gl_FragColor = vec4(0.08411, 0.25843, 0.08980, 1.0) + vec4(0.6*cubemapColor.xyz, 1.0) + 0.8*cdiff + anis;
         }
       );
+
+      string fragment_source;
+      get_diffraction_glsl(fragment_source, num_orders, num_wavelengths);
+      get_reflection_glsl(fragment_source);
+      fragment_source += fragment_shader;
     
       // use the common shader code to compile and link the shaders
       // the result is a shader program
-      shader::init(vertex_shader, fragment_shader);
+      shader::init(vertex_shader, fragment_source.c_str());
 
       // extract the indices of the uniforms to use later
       modelToProjectionIndex_ = glGetUniformLocation(program(), "modelToProjection");
@@ -126,32 +253,346 @@ namespace octet {
       samplerIndex_ = glGetUniformLocation(program(), "sampler");
     }
 
-    void render(const mat4t &modelToProjection, const mat4t &modelToWorld, mat4t &modelToWorldIT, 
+    void render(const mat4t &modelToProjection, const mat4t &modelToWorld, const mat3 &modelToWorldIT, 
       float rough, float spacing, vec4 &hiliteColor, vec3 &lightPosition, vec3 &cameraPosition, int sampler) {
       // tell openGL to use the program
       shader::render();
 
-      dynarray<float> modelToWorldIT3x3;
-      modelToWorldIT3x3.push_back(modelToWorldIT[0][0]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[1][0]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[2][0]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[0][1]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[1][1]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[2][1]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[0][2]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[1][2]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[2][2]);
+      // customize the program with uniforms
+      set_uniform(modelToProjectionIndex_, modelToProjection);
+      set_uniform(modelToWorldIndex_, modelToWorld);
+      set_uniform(modelToWorldITIndex_, modelToWorldIT);
+      set_uniform(roughIndex_, rough);
+      set_uniform(spacingIndex_, spacing);
+      set_uniform(hiliteColorIndex_, hiliteColor);
+      set_uniform(lightPositionIndex_, lightPosition);
+      set_uniform(cameraPositionIndex_, cameraPosition);
+      set_uniform(samplerIndex_, sampler);
+    }
+  };
+
+  /* cubemap_lutdiffraction_shader - Gives the same result as cubemap_fragdiffraction_shader
+   * but reads the diffraction colour and the anisotropic highlight from a 2D lookup texture
+   * instead of running the order loop and exp() for every fragment.
+   *
+   * The texture is indexed by (sqrt(|u|/8), |w|/2). The colour only depends on u and is zero
+   * beyond u = 7, the highlight depends on r * u / w, so spacing is applied before the lookup
+   * and the texture only has to be rebuilt (see update_lut) when the roughness changes.
+   */
+  class cubemap_lutdiffraction_shader : public shader {
+    enum { lut_size = 256 };
+
+    // index for model space to projection space matrix
+    GLuint modelToProjectionIndex_;
+    GLuint modelToWorldIndex_;
+    GLuint modelToWorldITIndex_;
+    GLuint roughIndex_;
+    GLuint spacingIndex_;
+    GLuint hiliteColorIndex_;
+    GLuint lightPositionIndex_;
+    GLuint cameraPositionIndex_;
+
+    // index for texture samplers
+    GLuint samplerIndex_;
+    GLuint lutIndex_;
+
+    // lookup texture and the roughness it was built for
+    GLuint lut_;
+    float lut_rough_;
+
+    static float blend(float x) {
+      float y = 1.0f - x*x;
+      return y > 0.0f ? y : 0.0f;
+    }
+
+    static uint8_t to_byte(float x) {
+      return x <= 0.0f ? 0 : x >= 1.0f ? 255 : (uint8_t)(x * 255.0f + 0.5f);
+    }
+
+  public:
+    cubemap_lutdiffraction_shader() {
+      lut_ = 0;
+      lut_rough_ = -1.0f;
+    }
+
+    void init() {
+      // this is the vertex shader.
+      // it is called for each corner of each triangle
+      // it inputs pos and uv from each corner
+      // it outputs gl_Position and uv_ to the rasterizer
+      const char vertex_shader[] = SHADER_STR(
+        varying vec3 position_;
+        varying vec3 normal_;
+        varying vec3 tangent_;
+
+        attribute vec4 pos;
+        attribute vec3 normal;
+        attribute vec3 tangent;
+
+        uniform mat4 modelToProjection;
+        uniform mat4 modelToWorld;
+        uniform mat3 modelToWorldIT;
+
+        void main() {
+          gl_Position = modelToProjection * pos;
+          position_ = (modelToWorld * pos).xyz;
+          normal_ = (modelToWorldIT * normal);
+          tangent_ = (modelToWorldIT * tangent);
+        }
+      );
+
+      // this is the fragment shader
+      // after the rasterizer breaks the triangle into fragments
+      // this is called for every fragment
+      // it outputs gl_FragColor, the color of the pixel and inputs uv_
+      const char fragment_shader[] = SHADER_STR(
+        varying vec3 position_;
+        varying vec3 normal_;
+        varying vec3 tangent_;
+
+        uniform samplerCube sampler;
+        uniform sampler2D lut;
+
+        uniform float r;
+        uniform float d;
+        uniform vec4 hiliteColor;
+        uniform vec3 lightPosition;
+        uniform vec3 cameraPosition;
+
+        void main() {
+          vec3 P = position_;
+          vec3 L = normalize(lightPosition - P);
+          vec3 V = normalize(cameraPosition - P);
+          vec3 H = L + V;
+          vec3 N = normal_;
+          vec3 T = tangent_;
+          float u = dot(T, H) * d;
+          float w = dot(N, H);
+
+          // rgb = 0.8 * diffraction colour, a = anisotropic highlight
+          vec4 diff = texture2D(lut, vec2(sqrt(abs(u) * 0.125), abs(w) * 0.5));
+          vec4 anis = hiliteColor * vec4(diff.www, 1.0);
+
+          vec4 cubemapColor = reflection_color(sampler, reflect(vec3(V.x, -V.y, V.z), N), r);
+
+          gl_FragColor = vec4(0.08411, 0.25843, 0.08980, 1.0) + vec4(0.6*cubemapColor.xyz, 1.0) + vec4(diff.xyz, 0.8) + anis;
+        }
+      );
+
+      string fragment_source;
+      get_reflection_glsl(fragment_source);
+      fragment_source += fragment_shader;
+
+      // use the common shader code to compile and link the shaders
+      // the result is a shader program
+      shader::init(vertex_shader, fragment_source.c_str());
+
+      // extract the indices of the uniforms to use later
+      modelToProjectionIndex_ = glGetUniformLocation(program(), "modelToProjection");
+      modelToWorldIndex_ = glGetUniformLocation(program(), "modelToWorld");
+      modelToWorldITIndex_ = glGetUniformLocation(program(), "modelToWorldIT");
+      roughIndex_ = glGetUniformLocation(program(), "r");
+      spacingIndex_ = glGetUniformLocation(program(), "d");
+      hiliteColorIndex_ = glGetUniformLocation(program(), "hiliteColor");
+      lightPositionIndex_ = glGetUniformLocation(program(), "lightPosition");
+      cameraPositionIndex_ = glGetUniformLocation(program(), "cameraPosition");
+
+      samplerIndex_ = glGetUniformLocation(program(), "sampler");
+      lutIndex_ = glGetUniformLocation(program(), "lut");
+
+      glGenTextures(1, &lut_);
+      lut_rough_ = -1.0f;
+    }
+
+    // rebuild the lookup texture if the roughness has changed since the last call.
+    void update_lut(float rough) {
+      if (rough == lut_rough_) return;
+      lut_rough_ = rough;
+
+      dynarray<uint8_t> image(lut_size * lut_size * 4);
+      uint8_t *dest = image.data();
+      float rsize = 1.0f / lut_size;
+      for (int j = 0; j != lut_size; ++j) {
+        float w = (j + 0.5f) * rsize * 2.0f;
+        for (int i = 0; i != lut_size; ++i) {
+          float s = (i + 0.5f) * rsize;
+          float u = s * s * 8.0f;
+
+          float e = rough * u / w;
+          float c = expf(-e * e);
+
+          float cr = 0, cg = 0, cb = 0;
+          for (int n = 1; n < 8; n++) {
+            float y = 2.0f * u / n - 1.0f;
+            cr += blend(4.0f * (y - 0.75f));
+            cg += blend(4.0f * (y - 0.5f));
+            cb += blend(4.0f * (y - 0.25f));
+          }
+
+          // the other terms are positive, so clamping here does not change the final colour.
+          dest[0] = to_byte(0.8f * cr);
+          dest[1] = to_byte(0.8f * cg);
+          dest[2] = to_byte(0.8f * cb);
+          dest[3] = to_byte(c);
+          dest += 4;
+        }
+      }
+
+      glBindTexture(GL_TEXTURE_2D, lut_);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, lut_size, lut_size, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void*)image.data());
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    GLuint get_lut() const {
+      return lut_;
+    }
+
+    // note: binds the lookup texture to texture unit lut_sampler and leaves GL_TEXTURE0 active.
+    void render(const mat4t &modelToProjection, const mat4t &modelToWorld, const mat3 &modelToWorldIT,
+      float spacing, vec4 &hiliteColor, vec3 &lightPosition, vec3 &cameraPosition, int sampler, int lut_sampler) {
+      // tell openGL to use the program
+      shader::render();
+
+      glActiveTexture(GL_TEXTURE0 + lut_sampler);
+      glBindTexture(GL_TEXTURE_2D, lut_);
+      glActiveTexture(GL_TEXTURE0);
+      get_stats().texture_calls += 3;
 
       // customize the program with uniforms
-      glUniformMatrix4fv(modelToProjectionIndex_, 1, GL_FALSE, modelToProjection.get());
-      glUniformMatrix4fv(modelToWorldIndex_, 1, GL_FALSE, modelToWorld.get());
-      glUniformMatrix3fv(modelToWorldITIndex_, 1, GL_FALSE, modelToWorldIT3x3.data());
-      glUniform1f(roughIndex_, rough);
-      glUniform1f(spacingIndex_, spacing);
-      glUniform4fv(hiliteColorIndex_, 1, hiliteColor.get());
-      glUniform3fv(lightPositionIndex_, 1, lightPosition.get());
-      glUniform3fv(cameraPositionIndex_, 1, cameraPosition.get());
-      glUniform1i(samplerIndex_, sampler);
+      set_uniform(modelToProjectionIndex_, modelToProjection);
+      set_uniform(modelToWorldIndex_, modelToWorld);
+      set_uniform(modelToWorldITIndex_, modelToWorldIT);
+      // the lookup texture has the highlight for this roughness, the reflection still needs it
+      set_uniform(roughIndex_, lut_rough_);
+      set_uniform(spacingIndex_, spacing);
+      set_uniform(hiliteColorIndex_, hiliteColor);
+      set_uniform(lightPositionIndex_, lightPosition);
+      set_uniform(cameraPositionIndex_, cameraPosition);
+      set_uniform(samplerIndex_, sampler);
+      set_uniform(lutIndex_, lut_sampler);
+    }
+  };
+
+  /* cubemap_instanceddiffraction_shader - cubemap_fragdiffraction_shader for drawing many
+   * copies of a mesh in one call (see instanced_mesh). The instance transform, the roughness
+   * and spacing (instanceParams.xy) and the hilite colour (color) are vertex attributes
+   * so they can come either from a per-instance buffer or be baked into merged vertices.
+   * The instance transforms are assumed to be rotations, translations and uniform scales.
+   */
+  class cubemap_instanceddiffraction_shader : public shader {
+
+    // index for model space to projection space matrix
+    GLuint modelToProjectionIndex_;
+    GLuint modelToWorldIndex_;
+    GLuint lightPositionIndex_;
+    GLuint cameraPositionIndex_;
+
+    // index for texture sampler
+    GLuint samplerIndex_;
+
+  public:
+    // num_orders and num_wavelengths select the variant, see get_diffraction_glsl.
+    void init(int num_orders = 7, int num_wavelengths = 0) {
+      // this is the vertex shader.
+      // it is called for each corner of each triangle of each instance
+      const char vertex_shader[] = SHADER_STR(
+        varying vec3 position_;
+        varying vec3 normal_;
+        varying vec3 tangent_;
+        varying vec2 params_;
+        varying vec4 hiliteColor_;
+
+        attribute vec4 pos;
+        attribute vec3 normal;
+        attribute vec3 tangent;
+        attribute vec4 color;
+        attribute vec4 instanceParams;
+        attribute mat4 instanceToModel;
+
+        uniform mat4 modelToProjection;
+        uniform mat4 modelToWorld;
+
+        void main() {
+          vec4 modelPos = instanceToModel * pos;
+          mat4 instanceToWorld = modelToWorld * instanceToModel;
+          mat3 instanceToWorld3x3 = mat3(instanceToWorld[0].xyz, instanceToWorld[1].xyz, instanceToWorld[2].xyz);
+          gl_Position = modelToProjection * modelPos;
+          position_ = (modelToWorld * modelPos).xyz;
+          normal_ = normalize(instanceToWorld3x3 * normal);
+          tangent_ = normalize(instanceToWorld3x3 * tangent);
+          params_ = instanceParams.xy;
+          hiliteColor_ = color;
+        }
+      );
+
+      // this is the fragment shader
+      // it is the same as cubemap_fragdiffraction_shader with r, d and hiliteColor interpolated
+      const char fragment_shader[] = SHADER_STR(
+        varying vec3 position_;
+        varying vec3 normal_;
+        varying vec3 tangent_;
+        varying vec2 params_;
+        varying vec4 hiliteColor_;
+
+        uniform samplerCube sampler;
+
+        uniform vec3 lightPosition;
+        uniform vec3 cameraPosition;
+
+        void main() {
+          vec3 P = position_;
+          vec3 L = normalize(lightPosition - P);
+          vec3 V = normalize(cameraPosition - P);
+          vec3 H = L + V;
+          vec3 N = normal_;
+          vec3 T = tangent_;
+          float u = dot(T, H) * params_.y;
+          float w = dot(N, H);
+          float e = params_.x * u / w;
+          float c = exp(-e * e);
+          vec4 anis = hiliteColor_ * vec4(c, c, c, 1.0);
+
+          if (u < 0.0) u = -u;
+
+          vec4 cdiff = vec4(diffraction_color(u), 1.0);
+
+          vec4 cubemapColor = reflection_color(sampler, reflect(vec3(V.x, -V.y, V.z), N), params_.x);
+
+          gl_FragColor = vec4(0.08411, 0.25843, 0.08980, 1.0) + vec4(0.6*cubemapColor.xyz, 1.0) + 0.8*cdiff + anis;
+        }
+      );
+
+      string fragment_source;
+      get_diffraction_glsl(fragment_source, num_orders, num_wavelengths);
+      get_reflection_glsl(fragment_source);
+      fragment_source += fragment_shader;
+
+      // use the common shader code to compile and link the shaders
+      // the result is a shader program
+      shader::init(vertex_shader, fragment_source.c_str());
+
+      // extract the indices of the uniforms to use later
+      modelToProjectionIndex_ = glGetUniformLocation(program(), "modelToProjection");
+      modelToWorldIndex_ = glGetUniformLocation(program(), "modelToWorld");
+      lightPositionIndex_ = glGetUniformLocation(program(), "lightPosition");
+      cameraPositionIndex_ = glGetUniformLocation(program(), "cameraPosition");
+
+      samplerIndex_ = glGetUniformLocation(program(), "sampler");
+    }
+
+    void render(const mat4t &modelToProjection, const mat4t &modelToWorld, vec3 &lightPosition, vec3 &cameraPosition, int sampler) {
+      // tell openGL to use the program
+      shader::render();
+
+      // customize the program with uniforms
+      set_uniform(modelToProjectionIndex_, modelToProjection);
+      set_uniform(modelToWorldIndex_, modelToWorld);
+      set_uniform(lightPositionIndex_, lightPosition);
+      set_uniform(cameraPositionIndex_, cameraPosition);
+      set_uniform(samplerIndex_, sampler);
     }
   };
 
@@ -176,7 +617,8 @@ namespace octet {
     GLuint samplerIndex_;
 
   public:
-    void init() {
+    // num_orders and num_wavelengths select the variant, see get_diffraction_glsl.
+    void init(int num_orders = 7, int num_wavelengths = 0) {
       // this is the vertex shader.
       // it is called for each corner of each triangle
       // it inputs pos and uv from each corner
@@ -200,12 +642,6 @@ namespace octet {
         uniform vec3 lightPosition;
         uniform vec3 cameraPosition;
 
-        vec3 blend3(vec3 x){
-          vec3 y = 1.0 - x*x;
-          y = max(y, vec3(0, 0, 0));
-          return (y);
-        }
-
         void main() {
           vec3 P = (modelToWorld * pos).xyz;
           vec3 L = normalize(lightPosition - P);
@@ -221,12 +657,8 @@ namespace octet {
 
           if (u < 0.0) u = -u;
 
-          vec4 cdiff = vec4(0.0, 0.0, 0.0, 1.0);
+          vec4 cdiff = vec4(diffraction_color(u), 1.0);
 
-          for (int n = 1; n < 8; n++) {
-            float y = 2.0 * u / float(n) - 1.0;
-            cdiff.xyz += blend3(vec3(4.0 * (y - 0.75), 4.0 * (y - 0.5), 4.0 * (y - 0.25)));
-          }
           gl_Position = modelToProjection * pos; 
           color_ = cdiff + anis;
           V_ = V;
@@ -244,16 +676,25 @@ namespace octet {
         varying vec3 V_;
 
         uniform samplerCube sampler;
+        uniform float r;
 
         void main() {
-          vec4 cubemapColor = textureCube(sampler, reflect(vec3(V_.x, -V_.y, V_.z), normal_));
+          vec4 cubemapColor = reflection_color(sampler, reflect(vec3(V_.x, -V_.y, V_.z), normal_), r);
           gl_FragColor = vec4(0.08411, 0.25843, 0.08980, 1.0) + vec4(0.6*cubemapColor.xyz, 1.0) + color_;
         }
       );
+
+      string vertex_source;
+      get_diffraction_glsl(vertex_source, num_orders, num_wavelengths);
+      vertex_source += vertex_shader;
+
+      string fragment_source;
+      get_reflection_glsl(fragment_source);
+      fragment_source += fragment_shader;
     
       // use the common shader code to compile and link the shaders
       // the result is a shader program
-      shader::init(vertex_shader, fragment_shader);
+      shader::init(vertex_source.c_str(), fragment_source.c_str());
 
       // extract the indices of the uniforms to use later
       modelToProjectionIndex_ = glGetUniformLocation(program(), "modelToProjection");
@@ -268,32 +709,21 @@ namespace octet {
       samplerIndex_ = glGetUniformLocation(program(), "sampler");
     }
 
-    void render(const mat4t &modelToProjection, const mat4t &modelToWorld, mat4t &modelToWorldIT, 
+    void render(const mat4t &modelToProjection, const mat4t &modelToWorld, const mat3 &modelToWorldIT, 
       float rough, float spacing, vec4 &hiliteColor, vec3 &lightPosition, vec3 &cameraPosition, int sampler) {
       // tell openGL to use the program
       shader::render();
 
-      dynarray<float> modelToWorldIT3x3;
-      modelToWorldIT3x3.push_back(modelToWorldIT[0][0]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[1][0]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[2][0]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[0][1]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[1][1]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[2][1]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[0][2]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[1][2]);
-      modelToWorldIT3x3.push_back(modelToWorldIT[2][2]);
-
       // customize the program with uniforms
-      glUniformMatrix4fv(modelToProjectionIndex_, 1, GL_FALSE, modelToProjection.get());
-      glUniformMatrix4fv(modelToWorldIndex_, 1, GL_FALSE, modelToWorld.get());
-      glUniformMatrix3fv(modelToWorldITIndex_, 1, GL_FALSE, modelToWorldIT3x3.data());
-      glUniform1f(roughIndex_, rough);
-      glUniform1f(spacingIndex_, spacing);
-      glUniform4fv(hiliteColorIndex_, 1, hiliteColor.get());
-      glUniform3fv(lightPositionIndex_, 1, lightPosition.get());
-      glUniform3fv(cameraPositionIndex_, 1, cameraPosition.get());
-      glUniform1i(samplerIndex_, sampler);
+      set_uniform(modelToProjectionIndex_, modelToProjection);
+      set_uniform(modelToWorldIndex_, modelToWorld);
+      set_uniform(modelToWorldITIndex_, modelToWorldIT);
+      set_uniform(roughIndex_, rough);
+      set_uniform(spacingIndex_, spacing);
+      set_uniform(hiliteColorIndex_, hiliteColor);
+      set_uniform(lightPositionIndex_, lightPosition);
+      set_uniform(cameraPositionIndex_, cameraPosition);
+      set_uniform(samplerIndex_, sampler);
     }
   };
 
@@ -356,9 +786,9 @@ namespace octet {
       shader::render();
 
       // customize the program with uniforms
-      glUniform1i(samplerIndex_, sampler);
-      glUniformMatrix4fv(modelToProjectionIndex_, 1, GL_FALSE, modelToProjection->get());
-      glUniformMatrix4fv(modelToWorldIndex_, 1, GL_FALSE, modelToWorld->get());
+      set_uniform(samplerIndex_, sampler);
+      set_uniform(modelToProjectionIndex_, *modelToProjection);
+      set_uniform(modelToWorldIndex_, *modelToWorld);
     }
   };
 
@@ -408,9 +838,97 @@ namespace octet {
       shader::render();
 
       // customize the program with uniforms
-      glUniform1i(samplerIndex_, sampler);
+      set_uniform(samplerIndex_, sampler);
+      // note: a count of 3 for a vec3 uniform makes GL reject this call, so cameraPosition stays zero.
+      // this is left as is (and uncached) so the sky does not change.
       glUniform3fv(cameraPositionIndex_, 3, cameraPosition->get());
-      glUniformMatrix4fv(modelToProjectionIndex_, 1, GL_FALSE, modelToProjection->get());
+      set_uniform(modelToProjectionIndex_, *modelToProjection);
+    }
+  };
+
+  /*
+   * diffraction_variants - compiles a diffraction shader (cubemap_diffraction_shader or
+   * cubemap_fragdiffraction_shader) once for each number of orders from 1 to max_orders.
+   *
+   * Call update() once a frame with the last frame time. While the frames take longer than
+   * the target we step down to a variant with fewer orders, and step back up when there is
+   * headroom, never going past the quality setting.
+   */
+  template <class shader_t> class diffraction_variants {
+    dynarray<shader_t*> variants;
+
+    // index of the variant in use and the highest one we are allowed
+    int current;
+    int quality;
+
+    float target_frame_time;
+    float average_frame_time;
+
+    // frames to wait after a change before measuring again
+    int settle_frames;
+
+  public:
+    diffraction_variants() {
+      current = quality = 0;
+      target_frame_time = 1.0f / 30;
+      average_frame_time = 0;
+      settle_frames = 0;
+    }
+
+    ~diffraction_variants() {
+      for (unsigned i = 0; i != variants.size(); ++i) {
+        delete variants[i];
+      }
+    }
+
+    void init(int max_orders = 7, int num_wavelengths = 0) {
+      for (int i = 0; i != max_orders; ++i) {
+        shader_t *variant = new shader_t();
+        variant->init(i + 1, num_wavelengths);
+        variants.push_back(variant);
+      }
+      current = quality = max_orders - 1;
+    }
+
+    // the shader to use for this frame
+    shader_t &get() {
+      return *variants[current];
+    }
+
+    int get_num_orders() const {
+      return current + 1;
+    }
+
+    // highest number of orders to use
+    int get_quality() const {
+      return quality + 1;
+    }
+
+    void set_quality(int num_orders) {
+      int max_quality = (int)variants.size() - 1;
+      quality = num_orders - 1 < 0 ? 0 : num_orders - 1 > max_quality ? max_quality : num_orders - 1;
+      if (current > quality) current = quality;
+      settle_frames = 0;
+    }
+
+    void set_target_frame_time(float seconds) {
+      target_frame_time = seconds;
+    }
+
+    void update(float frame_time) {
+      average_frame_time += (frame_time - average_frame_time) * 0.1f;
+      if (settle_frames) {
+        settle_frames--;
+        return;
+      }
+
+      if (average_frame_time > target_frame_time && current > 0) {
+        current--;
+        settle_frames = 30;
+      } else if (average_frame_time < target_frame_time * 0.75f && current < quality) {
+        current++;
+        settle_frames = 30;
+      }
     }
   };
 }
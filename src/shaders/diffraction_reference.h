@@ -0,0 +1,173 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// CPU version of the diffraction shader
+//
+
+namespace octet {
+  /*
+   * diffraction_reference - evaluates what cubemap_fragdiffraction_shader draws
+   * (diffraction orders, anisotropic highlight and cube map reflection) on the CPU.
+   *
+   * shade() takes arrays of world space position, normal and tangent, as the fragment
+   * shader receives them, and works on four samples at a time: each vec4 holds one
+   * component of four samples, so the SSE vec4 operators do the arithmetic.
+   * Only the cube map lookup is done one sample at a time; it reads the same prefiltered
+   * level as the shader, blending the two nearest levels of the chain.
+   *
+   * Use it as a reference to check the shaders against, or to draw without a GPU.
+   */
+  class diffraction_reference {
+  public:
+    // the uniforms of the diffraction shader
+    struct params {
+      float rough;
+      float spacing;
+      vec4 hiliteColor;
+      vec3 lightPosition;
+      vec3 cameraPosition;
+      int num_orders;
+    };
+
+  private:
+    // x, y and z of four vectors
+    struct vec3x4 {
+      vec4 x, y, z;
+    };
+
+    // load four vectors starting at src[i]. past the end, repeat the last one.
+    static vec3x4 load(const vec3 *src, unsigned i, unsigned count) {
+      const vec3 &a = src[i];
+      const vec3 &b = src[i+1 < count ? i+1 : count-1];
+      const vec3 &c = src[i+2 < count ? i+2 : count-1];
+      const vec3 &d = src[i+3 < count ? i+3 : count-1];
+      vec3x4 r;
+      r.x = vec4(a[0], b[0], c[0], d[0]);
+      r.y = vec4(a[1], b[1], c[1], d[1]);
+      r.z = vec4(a[2], b[2], c[2], d[2]);
+      return r;
+    }
+
+    static vec3x4 sub(const vec3 &a, const vec3x4 &b) {
+      vec3x4 r;
+      r.x = vec4(a[0]) - b.x;
+      r.y = vec4(a[1]) - b.y;
+      r.z = vec4(a[2]) - b.z;
+      return r;
+    }
+
+    static vec4 dot(const vec3x4 &a, const vec3x4 &b) {
+      return a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+
+    static vec4 sqrt4(const vec4 &x) {
+      #ifdef OCTET_SSE
+        return vec4(_mm_sqrt_ps(x.get_m()));
+      #else
+        return vec4(sqrtf(x[0]), sqrtf(x[1]), sqrtf(x[2]), sqrtf(x[3]));
+      #endif
+    }
+
+    static vec3x4 normalize(const vec3x4 &a) {
+      vec4 rlen = vec4(1.0f) / sqrt4(dot(a, a));
+      vec3x4 r;
+      r.x = a.x * rlen;
+      r.y = a.y * rlen;
+      r.z = a.z * rlen;
+      return r;
+    }
+
+    // e^x for four values. with SSE, 2^n * 2^f with f in [-0.5, 0.5] and a degree 6 series.
+    // the relative error is under 1e-5, far below what an 8 bit colour can show.
+    static vec4 exp4(const vec4 &x) {
+      #ifdef OCTET_SSE
+        __m128 t = _mm_mul_ps(_mm_max_ps(_mm_min_ps(x.get_m(), _mm_set1_ps(88.0f)), _mm_set1_ps(-87.0f)), _mm_set1_ps(1.44269504f));
+        __m128i n = _mm_cvtps_epi32(t);
+        __m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(n));
+        vec4 fv(f);
+        vec4 p = vec4(1.0f) + fv * (0.69314718f + fv * (0.24022651f + fv * (0.05550411f + fv * (0.00961813f + fv * (0.00133336f + fv * 0.00015404f)))));
+        __m128 pow2n = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23));
+        return p * vec4(pow2n);
+      #else
+        return vec4(expf(x[0]), expf(x[1]), expf(x[2]), expf(x[3]));
+      #endif
+    }
+
+    // blend3 from the GLSL, one channel
+    static vec4 bump(const vec4 &x) {
+      return max(vec4(1.0f) - x * x, vec4(0.0f));
+    }
+
+  public:
+    static void init_params(params &p) {
+      p.rough = 50.0f;
+      p.spacing = 10.0f;
+      p.hiliteColor = vec4(1.0f, 0.7f, 0.3f, 1.0f);
+      p.lightPosition = vec3(0.0f, 0.0f, 1.0f);
+      p.cameraPosition = vec3(0.0f, 0.0f, 3.0f);
+      p.num_orders = 7;
+    }
+
+    // colour[i] = the diffraction shader's gl_FragColor for P[i], N[i] and T[i], clamped to [0, 1].
+    // N and T are not normalized, as in the shader.
+    static void shade(vec4 *color, const vec3 *P, const vec3 *N, const vec3 *T, unsigned count, const params &p, const cubemap_image &sky) {
+      vec4 zero(0.0f), one(1.0f);
+
+      // the prefiltered level that reflection_color reads, see get_reflection_glsl
+      float lod = max(log2f(cubemap_prefilter::get_lod_scale() / p.rough), 0.0f);
+
+      for (unsigned i = 0; i < count; i += 4) {
+        vec3x4 P4 = load(P, i, count);
+        vec3x4 N4 = load(N, i, count);
+        vec3x4 T4 = load(T, i, count);
+
+        vec3x4 L = normalize(sub(p.lightPosition, P4));
+        vec3x4 V = normalize(sub(p.cameraPosition, P4));
+        vec3x4 H;
+        H.x = L.x + V.x;
+        H.y = L.y + V.y;
+        H.z = L.z + V.z;
+
+        vec4 u = dot(T4, H) * p.spacing;
+        vec4 w = dot(N4, H);
+        vec4 e = vec4(p.rough) * u / w;
+        vec4 c = exp4(-(e * e));
+
+        u = abs(u);
+
+        vec4 cr = zero, cg = zero, cb = zero;
+        for (int n = 1; n <= p.num_orders; n++) {
+          vec4 y = u * (2.0f / n) - 1.0f;
+          cr += bump((y - 0.75f) * 4.0f);
+          cg += bump((y - 0.5f) * 4.0f);
+          cb += bump((y - 0.25f) * 4.0f);
+        }
+
+        // reflect(vec3(V.x, -V.y, V.z), N)
+        vec3x4 I;
+        I.x = V.x;
+        I.y = -V.y;
+        I.z = V.z;
+        vec4 k = dot(N4, I) * 2.0f;
+        vec4 rx = I.x - N4.x * k;
+        vec4 ry = I.y - N4.y * k;
+        vec4 rz = I.z - N4.z * k;
+
+        vec4 r = vec4(0.08411f) + cr * 0.8f + c * p.hiliteColor[0];
+        vec4 g = vec4(0.25843f) + cg * 0.8f + c * p.hiliteColor[1];
+        vec4 b = vec4(0.08980f) + cb * 0.8f + c * p.hiliteColor[2];
+        float a = max(min(2.8f + p.hiliteColor[3], 1.0f), 0.0f);
+
+        unsigned num_lanes = count - i < 4 ? count - i : 4;
+        for (unsigned lane = 0; lane != num_lanes; ++lane) {
+          vec4 cube = sky.sample(vec3(rx[lane], ry[lane], rz[lane]), lod);
+          color[i + lane] = min(max(vec4(r[lane], g[lane], b[lane], 0.0f) + cube * 0.6f, zero), one);
+          color[i + lane][3] = a;
+        }
+      }
+    }
+  };
+}
@@ -102,17 +102,17 @@ namespace octet {
       shader::render();
 
       // customize the program with uniforms
-      glUniform3fv(light_direction_index, 1, light_direction.get());
-      glUniformMatrix4fv(modelToProjection_index, 1, GL_FALSE, modelToProjection.get());
-      glUniformMatrix4fv(modelToCamera_index, 1, GL_FALSE, modelToCamera.get());
-      glUniform4fv(light_ambient_index, 1, light_ambient.get());
-      glUniform4fv(light_diffuse_index, 1, light_diffuse.get());
-      glUniform4fv(light_specular_index, 1, light_specular.get());
-      glUniform1f(shininess_index, shininess);
+      set_uniform(light_direction_index, light_direction.xyz());
+      set_uniform(modelToProjection_index, modelToProjection);
+      set_uniform(modelToCamera_index, modelToCamera);
+      set_uniform(light_ambient_index, light_ambient);
+      set_uniform(light_diffuse_index, light_diffuse);
+      set_uniform(light_specular_index, light_specular);
+      set_uniform(shininess_index, shininess);
 
       // we use textures 0-3 for material properties.
       static const GLint samplers[] = { 0, 1, 2, 3, 4 };
-      glUniform1iv(samplers_index, num_samplers, samplers);
+      set_uniform(samplers_index, samplers, num_samplers);
     }
 
     void render_skinned(const mat4t &cameraToProjection, const mat4t *modelToCamera, int num_matrices, const vec4 &light_direction, float shininess, vec4 &light_ambient, vec4 &light_diffuse, vec4 &light_specular, int num_samplers=4) {
@@ -120,17 +120,17 @@ namespace octet {
       shader::render();
 
       // customize the program with uniforms
-      glUniform3fv(light_direction_index, 1, light_direction.get());
-      glUniformMatrix4fv(cameraToProjection_index, 1, GL_FALSE, cameraToProjection.get());
-      glUniformMatrix4fv(modelToCamera_index, num_matrices, GL_FALSE, (float*)modelToCamera);
-      glUniform4fv(light_ambient_index, 1, light_ambient.get());
-      glUniform4fv(light_diffuse_index, 1, light_diffuse.get());
-      glUniform4fv(light_specular_index, 1, light_specular.get());
-      glUniform1f(shininess_index, shininess);
+      set_uniform(light_direction_index, light_direction.xyz());
+      set_uniform(cameraToProjection_index, cameraToProjection);
+      set_uniform(modelToCamera_index, modelToCamera, num_matrices);
+      set_uniform(light_ambient_index, light_ambient);
+      set_uniform(light_diffuse_index, light_diffuse);
+      set_uniform(light_specular_index, light_specular);
+      set_uniform(shininess_index, shininess);
 
       // we use textures 0-3 for material properties.
       static const GLint samplers[] = { 0, 1, 2, 3, 4 };
-      glUniform1iv(samplers_index, num_samplers, samplers);
+      set_uniform(samplers_index, samplers, num_samplers);
     }
   };
 }
@@ -12,7 +12,106 @@
 
 namespace octet {
   class shader {
+  public:
+    // gl calls made and skipped by the shadow state, see get_stats()
+    struct stats {
+      unsigned program_binds;
+      unsigned program_binds_skipped;
+      unsigned uniform_sets;
+      unsigned uniform_sets_skipped;
+      // texture unit and bind calls made by shaders that own a texture, eg. the diffraction lookup
+      unsigned texture_calls;
+    };
+
+  private:
     GLuint program_;
+
+    // the last value sent to a uniform location of this program, stored in uniform_bytes
+    struct uniform_value {
+      GLint location;
+      unsigned offset;
+      unsigned size;
+    };
+    dynarray<uniform_value> uniform_values;
+    dynarray<uint8_t> uniform_bytes;
+
+    // the program we last passed to glUseProgram
+    static GLuint &bound_program() {
+      static GLuint program;
+      return program;
+    }
+
+  protected:
+    // true if the value differs from the last one set for this location. also records the value.
+    bool uniform_changed(GLint location, const void *value, unsigned size) {
+      if (location == -1) return false;
+      for (unsigned i = 0; i != uniform_values.size(); ++i) {
+        uniform_value &u = uniform_values[i];
+        if (u.location == location) {
+          if (u.size == size && !memcmp(&uniform_bytes[u.offset], value, size)) {
+            get_stats().uniform_sets_skipped++;
+            return false;
+          }
+          if (size > u.size) {
+            // arrays can grow, eg. the number of lights; move to the end of the store.
+            u.offset = uniform_bytes.size();
+            uniform_bytes.resize(u.offset + size);
+          }
+          u.size = size;
+          memcpy(&uniform_bytes[u.offset], value, size);
+          get_stats().uniform_sets++;
+          return true;
+        }
+      }
+      uniform_value u;
+      u.location = location;
+      u.offset = uniform_bytes.size();
+      u.size = size;
+      uniform_bytes.resize(u.offset + size);
+      memcpy(&uniform_bytes[u.offset], value, size);
+      uniform_values.push_back(u);
+      get_stats().uniform_sets++;
+      return true;
+    }
+
+    // set uniforms, skipping the GL call if the program already has this value
+    void set_uniform(GLint location, int value) {
+      if (uniform_changed(location, &value, sizeof(value))) glUniform1i(location, value);
+    }
+
+    void set_uniform(GLint location, float value) {
+      if (uniform_changed(location, &value, sizeof(value))) glUniform1f(location, value);
+    }
+
+    void set_uniform(GLint location, const vec3 &value) {
+      if (uniform_changed(location, value.get(), sizeof(float) * 3)) glUniform3fv(location, 1, value.get());
+    }
+
+    void set_uniform(GLint location, const vec4 &value) {
+      if (uniform_changed(location, value.get(), sizeof(float) * 4)) glUniform4fv(location, 1, value.get());
+    }
+
+    void set_uniform(GLint location, const mat3 &value) {
+      if (uniform_changed(location, value.get(), sizeof(float) * 9)) glUniformMatrix3fv(location, 1, GL_FALSE, value.get());
+    }
+
+    void set_uniform(GLint location, const mat4t &value) {
+      if (uniform_changed(location, value.get(), sizeof(float) * 16)) glUniformMatrix4fv(location, 1, GL_FALSE, value.get());
+    }
+
+    // arrays of uniforms
+    void set_uniform(GLint location, const int *values, int count) {
+      if (uniform_changed(location, values, sizeof(int) * count)) glUniform1iv(location, count, values);
+    }
+
+    void set_uniform(GLint location, const vec4 *values, int count) {
+      if (uniform_changed(location, values, sizeof(vec4) * count)) glUniform4fv(location, count, (const float*)values);
+    }
+
+    void set_uniform(GLint location, const mat4t *values, int count) {
+      if (uniform_changed(location, values, sizeof(mat4t) * count)) glUniformMatrix4fv(location, count, GL_FALSE, (const float*)values);
+    }
+
   public:
     shader() {}
 
@@ -51,16 +150,41 @@ namespace octet {
       glBindAttribLocation(program, attribute_blendindices, "blendindices");
       glBindAttribLocation(program, attribute_color, "color");
       glBindAttribLocation(program, attribute_uv, "uv");
+      glBindAttribLocation(program, attribute_instance_matrix, "instanceToModel");
+      glBindAttribLocation(program, attribute_instance_params, "instanceParams");
       glLinkProgram(program);
 
       program_ = program;
+      uniform_values.reset();
+      uniform_bytes.reset();
       glGetProgramInfoLog(program, sizeof(buf), &length, buf);
       puts(buf);
     }
   
     // use the program we have compiled in init()
     void render() {
-      glUseProgram(program_);
+      if (bound_program() != program_) {
+        glUseProgram(program_);
+        bound_program() = program_;
+        get_stats().program_binds++;
+      } else {
+        get_stats().program_binds_skipped++;
+      }
+    }
+
+    // call this if something else has called glUseProgram
+    static void invalidate_bound_program() {
+      bound_program() = 0;
+    }
+
+    // counters for all shaders. reset them once a frame to see how many gl calls the cache saved.
+    static stats &get_stats() {
+      static stats s;
+      return s;
+    }
+
+    static void reset_stats() {
+      memset(&get_stats(), 0, sizeof(stats));
     }
   };
 
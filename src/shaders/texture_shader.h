@@ -56,8 +56,8 @@ namespace octet {
       shader::render();
 
       // customize the program with uniforms
-      glUniform1i(samplerIndex_, sampler);
-      glUniformMatrix4fv(modelToProjectionIndex_, 1, GL_FALSE, modelToProjection.get());
+      set_uniform(samplerIndex_, sampler);
+      set_uniform(modelToProjectionIndex_, modelToProjection);
     }
   };
 }